@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <chrono>
+#include "Chip8.h"
+
+// Compares the compile-time dispatch table against the nested switch decoder on the bundled ROMs.
+// Both decoders run the same handlers, so the final framebuffers must match.
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "Build"
+#endif
+
+static const char * roms[] = { "pong2.c8", "tetris.c8", "invaders.c8" };
+
+Chip8 interpreter;
+
+double run(const std::string & path, unsigned long long cycles, bool useTable, unsigned long long & hash) {
+	interpreter.loadApplication(path.c_str());
+	interpreter.seedRandom(1); // Same random sequence for both decoders
+
+	auto start = std::chrono::steady_clock::now();
+	if (useTable) {
+		for (unsigned long long i = 0; i < cycles; ++i)
+			interpreter.emulateCycle();
+	}
+	else {
+		for (unsigned long long i = 0; i < cycles; ++i)
+			interpreter.emulateCycleSwitch();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	hash = interpreter.frameHash();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+	const char * romDir = argc > 1 ? argv[1] : CHIP8_ROM_DIR;
+	unsigned long long cycles = argc > 2 ? strtoull(argv[2], NULL, 10) : 20000000;
+	bool match = true;
+
+	printf("%-12s %12s %12s %8s\n", "rom", "switch MIPS", "table MIPS", "speedup");
+	for (const char * rom : roms) {
+		std::string path = std::string(romDir) + "/" + rom;
+		unsigned long long switchHash, tableHash;
+		double switchTime = run(path, cycles, false, switchHash);
+		double tableTime = run(path, cycles, true, tableHash);
+
+		printf("%-12s %12.1f %12.1f %7.2fx%s\n", rom, cycles / switchTime / 1e6, cycles / tableTime / 1e6,
+			switchTime / tableTime, switchHash == tableHash ? "" : "  FRAMEBUFFER MISMATCH");
+		match = match && switchHash == tableHash;
+	}
+
+	return match ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include "Chip8Batch.h"
+#include "Chip8Lockstep.h"
+
+// Steps 32 instances of each bundled ROM with the scalar batch path on one thread and with
+// the lock-step engine at 8, 16 and 32 lanes, once with every instance sharing a seed and once
+// with a seed each. The final framebuffers must match the scalar instances lane for lane.
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "Build"
+#endif
+
+static const char * roms[] = { "pong2.c8", "tetris.c8", "invaders.c8" };
+static const int instances = 32;
+
+static std::vector<unsigned char> readRom(const std::string & path) {
+	std::vector<unsigned char> data;
+	FILE * pFile = fopen(path.c_str(), "rb");
+	if (pFile == NULL)
+		return data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(pFile);
+	return data;
+}
+
+// Runs every instance in groups of Lanes, returns seconds and the share of lane-steps done by kernels
+template <int Lanes>
+double runLockstep(const std::vector<unsigned char> & rom, unsigned long long frames, bool shareSeed, std::vector<unsigned long long> & hashes, double & vectorShare) {
+	double seconds = 0;
+	unsigned long long vectorSteps = 0, scalarSteps = 0;
+	hashes.clear();
+
+	for (int group = 0; group < instances / Lanes; ++group) {
+		std::unique_ptr<Chip8Lockstep<Lanes> > lanes(new Chip8Lockstep<Lanes>());
+		lanes->loadApplication(rom.data(), rom.size());
+		for (int l = 0; l < Lanes; ++l)
+			lanes->seedRandom(l, shareSeed ? 1 : group * Lanes + l + 1);
+
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned long long f = 0; f < frames; ++f)
+			lanes->runFrame();
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (int l = 0; l < Lanes; ++l)
+			hashes.push_back(lanes->frameHash(l));
+		vectorSteps += lanes->vectorSteps;
+		scalarSteps += lanes->scalarSteps;
+	}
+
+	vectorShare = (double)vectorSteps / (vectorSteps + scalarSteps);
+	return seconds;
+}
+
+int main(int argc, char **argv)
+{
+	const char * romDir = argc > 1 ? argv[1] : CHIP8_ROM_DIR;
+	unsigned long long frames = argc > 2 ? strtoull(argv[2], NULL, 10) : 36000;
+	const unsigned int cyclesPerFrame = 10;
+	bool match = true;
+
+	printf("instance-steps/second (millions), %d instances, %llu frames\n", instances, frames);
+	printf("%-12s %-9s %8s %8s %8s %8s %8s\n", "rom", "seeds", "scalar", "8 lanes", "16 lanes", "32 lanes", "vector%");
+	for (const char * rom : roms) {
+		std::string path = std::string(romDir) + "/" + rom;
+		std::vector<unsigned char> data = readRom(path);
+
+		// Shared seeds keep the lanes together unless the program itself diverges;
+		// distinct seeds split them apart as soon as CXNN is used
+		for (int shareSeed = 1; shareSeed >= 0; --shareSeed) {
+			// Idle skipping off, so both paths execute every instruction
+			Chip8Batch batch(1);
+			for (int i = 0; i < instances; ++i) {
+				Chip8BatchJob job = { path, frames, false, shareSeed ? 1 : (uint64_t)i + 1, Chip8Engine::Interpreter, Chip8Quirks::Default, cyclesPerFrame, false };
+				batch.add(job);
+			}
+			batch.run();
+
+			std::vector<unsigned long long> hashes8, hashes16, hashes32;
+			double share8, share16, share32;
+			double seconds8 = runLockstep<8>(data, frames, shareSeed != 0, hashes8, share8);
+			double seconds16 = runLockstep<16>(data, frames, shareSeed != 0, hashes16, share16);
+			double seconds32 = runLockstep<32>(data, frames, shareSeed != 0, hashes32, share32);
+
+			bool same = batch.results().size() == (size_t)instances;
+			for (int i = 0; same && i < instances; ++i) {
+				unsigned long long hash = batch.results()[i].frameHash;
+				same = hashes8[i] == hash && hashes16[i] == hash && hashes32[i] == hash;
+			}
+			match = match && same;
+
+			double steps = (double)instances * frames * cyclesPerFrame / 1e6;
+			printf("%-12s %-9s %8.1f %8.1f %8.1f %8.1f %7.0f%%%s\n", rom, shareSeed ? "shared" : "distinct",
+				steps / batch.seconds, steps / seconds8, steps / seconds16, steps / seconds32, share32 * 100,
+				same ? "" : "  FRAMEBUFFER MISMATCH");
+		}
+	}
+
+	return match ? 0 : 1;
+}
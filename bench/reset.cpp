@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "Chip8.h"
+#include "Chip8State.h"
+
+// Resets instances of each bundled ROM back to the freshly loaded state after a short run, the
+// inner loop of fuzzing and search, three ways: reloading the application from a buffer,
+// loading a full save-state, and resetting to a snapshot through the dirty page tracking.
+// Every reset must leave the instance identical to the snapshot.
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "Build"
+#endif
+
+static const char * roms[] = { "pong2.c8", "tetris.c8", "invaders.c8" };
+static const int instances = 256;
+
+enum class ResetMethod { Reload, LoadState, ResetTo };
+
+static std::vector<unsigned char> readRom(const std::string & path) {
+	std::vector<unsigned char> data;
+	FILE * pFile = fopen(path.c_str(), "rb");
+	if (pFile == NULL)
+		return data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(pFile);
+	return data;
+}
+
+// Runs every instance for a few frames with random keys, then times resetting them all.
+// Returns resets per second; same is cleared if a reset doesn't reproduce the snapshot.
+static double run(const std::vector<unsigned char> & rom, ResetMethod method, unsigned int runFrames, int rounds, bool & same) {
+	std::vector<Chip8> c8(instances);
+	std::vector<Chip8State> snapshots(instances);
+	for (int i = 0; i < instances; ++i) {
+		c8[i].loadApplication(rom.data(), rom.size());
+		c8[i].seedRandom(i + 1);
+		c8[i].snapshot(snapshots[i]);
+	}
+
+	double seconds = 0;
+	srand(1);
+	for (int round = 0; round < rounds; ++round) {
+		for (int i = 0; i < instances; ++i) {
+			for (int k = 0; k < 16; ++k)
+				c8[i].key[k] = (rand() & 7) == 0;
+			for (unsigned int f = 0; f < runFrames; ++f)
+				c8[i].runFrame();
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		switch (method) {
+		case ResetMethod::Reload:
+			for (int i = 0; i < instances; ++i) {
+				c8[i].loadApplication(rom.data(), rom.size());
+				c8[i].seedRandom(i + 1);
+			}
+			break;
+		case ResetMethod::LoadState:
+			for (int i = 0; i < instances; ++i)
+				c8[i].loadState(snapshots[i]);
+			break;
+		case ResetMethod::ResetTo:
+			for (int i = 0; i < instances; ++i)
+				c8[i].resetTo(snapshots[i]);
+			break;
+		}
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (int i = 0; i < instances; ++i) {
+			Chip8State state;
+			c8[i].saveState(state);
+			same = same && memcmp(&state, &snapshots[i], sizeof(Chip8State)) == 0;
+		}
+	}
+
+	return (double)instances * rounds / seconds;
+}
+
+int main(int argc, char **argv)
+{
+	const char * romDir = argc > 1 ? argv[1] : CHIP8_ROM_DIR;
+	int rounds = argc > 2 ? atoi(argv[2]) : 400;
+	bool match = true;
+
+	printf("resets/second (millions), %d instances, %d rounds\n", instances, rounds);
+	printf("%-12s %6s %10s %10s %10s\n", "rom", "frames", "reload", "loadState", "resetTo");
+	for (const char * rom : roms) {
+		std::vector<unsigned char> data = readRom(std::string(romDir) + "/" + rom);
+
+		for (unsigned int runFrames : { 1u, 60u }) {
+			bool same = true;
+			double reload = run(data, ResetMethod::Reload, runFrames, rounds, same);
+			double loadState = run(data, ResetMethod::LoadState, runFrames, rounds, same);
+			double resetTo = run(data, ResetMethod::ResetTo, runFrames, rounds, same);
+			match = match && same;
+
+			printf("%-12s %6u %10.2f %10.2f %10.2f%s\n", rom, runFrames, reload / 1e6, loadState / 1e6, resetTo / 1e6,
+				same ? "" : "  STATE MISMATCH");
+		}
+	}
+
+	return match ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "Chip8.h"
+
+// Benchmark suite for tracking performance across versions. Runs the bundled ROMs with
+// scripted input on every engine, times single handlers through the dispatch table, and runs
+// synthetic ROMs with controlled opcode mixes. Results go to stdout as JSON, a summary to stderr.
+// Every timing is the best of several repeats; framebuffer hashes are included so a change in
+// behaviour shows up alongside a change in speed.
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "Build"
+#endif
+
+static const char * roms[] = { "pong2.c8", "tetris.c8", "invaders.c8" };
+
+static const Chip8Engine engines[] = { Chip8Engine::Interpreter, Chip8Engine::Cached, Chip8Engine::Jit };
+static const char * engineNames[] = { "interpreter", "cached", "jit" };
+
+static std::vector<unsigned char> readRom(const std::string & path) {
+	std::vector<unsigned char> data;
+	FILE * pFile = fopen(path.c_str(), "rb");
+	if (pFile == NULL)
+		return data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(pFile);
+	return data;
+}
+
+static double since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Holds one key at a time, walking through all 16: each is down for 10 frames out of every 15
+static void scriptKeys(Chip8 & c8, unsigned long long frame) {
+	int held = (int)((frame / 15) % 16);
+	bool down = frame % 15 < 10;
+	for (int i = 0; i < 16; ++i)
+		c8.key[i] = i == held && down;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// Synthetic opcode mixes
+
+struct Chip8Mix {
+	const char * name;
+	unsigned int weights[4];	// ALU, skip, memory, draw
+};
+
+static const Chip8Mix mixes[] = {
+	{ "alu",    { 1, 0, 0, 0 } },
+	{ "skip",   { 0, 1, 0, 0 } },
+	{ "memory", { 0, 0, 1, 0 } },
+	{ "draw",   { 0, 0, 0, 1 } },
+	{ "mixed",  { 6, 2, 1, 1 } }
+};
+
+static unsigned int mixRandom(unsigned int & state) {
+	state = state * 1103515245 + 12345;
+	return state >> 16;
+}
+
+// A loop of about 256 instructions drawn from the mix, then a jump back to the start. Registers
+// V0-VE are scratch and VF is left to the flags; I stays in 0xE00-0xF10, away from the code.
+static std::vector<unsigned char> buildMix(const Chip8Mix & mix) {
+	unsigned int state = 1;
+	unsigned int total = mix.weights[0] + mix.weights[1] + mix.weights[2] + mix.weights[3];
+	std::vector<unsigned short> ops;
+
+	while (ops.size() < 256) {
+		unsigned int pick = mixRandom(state) % total, kind = 0;
+		while (pick >= mix.weights[kind])
+			pick -= mix.weights[kind++];
+
+		unsigned short x = mixRandom(state) % 15, y = mixRandom(state) % 15, nn = mixRandom(state) & 0xFF;
+		static const unsigned short alu[] = { 0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006, 0x8007, 0x800E };
+		switch (kind) {
+		case 0:		// 6XNN, 7XNN and the 8XY* group
+			switch (mixRandom(state) % 4) {
+			case 0: ops.push_back(0x6000 | x << 8 | nn); break;
+			case 1: ops.push_back(0x7000 | x << 8 | nn); break;
+			default: ops.push_back(alu[mixRandom(state) % 9] | x << 8 | y << 4); break;
+			}
+			break;
+		case 1:		// A skip over a 7XNN, taken or not depending on the registers
+			switch (mixRandom(state) % 4) {
+			case 0: ops.push_back(0x3000 | x << 8 | nn); break;
+			case 1: ops.push_back(0x4000 | x << 8 | nn); break;
+			case 2: ops.push_back(0x5000 | x << 8 | y << 4); break;
+			default: ops.push_back(0x9000 | x << 8 | y << 4); break;
+			}
+			ops.push_back(0x7000 | y << 8 | nn);
+			break;
+		case 2:		// ANNN then one of FX33, FX55, FX65 and FX1E
+			ops.push_back(0xAE00 | nn);
+			switch (mixRandom(state) % 4) {
+			case 0: ops.push_back(0xF033 | x << 8); break;
+			case 1: ops.push_back(0xF055 | x << 8); break;
+			case 2: ops.push_back(0xF065 | x << 8); break;
+			default: ops.push_back(0xF01E | x << 8); break;
+			}
+			break;
+		default:	// DXYN from a font character
+			ops.push_back(0xF029 | x << 8);
+			ops.push_back(0xD000 | x << 8 | y << 4 | (1 + mixRandom(state) % 15));
+			break;
+		}
+	}
+	ops.push_back(0x1200);
+
+	std::vector<unsigned char> rom;
+	for (unsigned short op : ops) {
+		rom.push_back(op >> 8);
+		rom.push_back(op & 0xFF);
+	}
+	return rom;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// Single handlers, called through the dispatch table without fetching
+
+struct Chip8HandlerBench {
+	const char * name;
+	unsigned short opcode;
+};
+
+static const Chip8HandlerBench handlers[] = {
+	{ "disp",     0xD018 },		// DXYN, an 8 row sprite
+	{ "setBCD",   0xF033 },
+	{ "regDump",  0xFF55 },
+	{ "regLoad",  0xFF65 },
+	{ "8XY0",     0x8010 },
+	{ "8XY1",     0x8011 },
+	{ "8XY2",     0x8012 },
+	{ "8XY3",     0x8013 },
+	{ "8XY4",     0x8014 },
+	{ "8XY5",     0x8015 },
+	{ "8XY6",     0x8016 },
+	{ "8XY7",     0x8017 },
+	{ "8XYE",     0x801E }
+};
+
+static double timeHandler(unsigned short opcode, unsigned long long calls) {
+	Chip8 c8;
+	c8.loadApplication(NULL, 0);
+	// V0-VE = 0x13, 0x26, ... and I in the free area at 0xE00
+	for (int x = 0; x < 15; ++x) {
+		const Chip8Op & set = Chip8::decode(0x6000 | x << 8 | ((x + 1) * 0x13 & 0xFF));
+		set.exec(c8, set);
+	}
+	const Chip8Op & setI = Chip8::decode(0xAE00);
+	setI.exec(c8, setI);
+
+	const Chip8Op & op = Chip8::decode(opcode);
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < calls; ++i)
+		op.exec(c8, op);
+	return since(start);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	const char * romDir = CHIP8_ROM_DIR;
+	unsigned long long frames = 100000;
+	int repeats = 3;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			repeats = atoi(argv[++i]);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Usage: chip8bench [-f frames] [-r repeats] [rom directory] > results.json\n");
+			return 1;
+		}
+		else
+			romDir = argv[i];
+	}
+	if (repeats < 1)
+		repeats = 1;
+
+	const unsigned int cyclesPerFrame = 10;
+	unsigned long long mixCycles = frames * cyclesPerFrame;
+	unsigned long long handlerCalls = frames * cyclesPerFrame;
+
+	printf("{\n");
+	printf("  \"version\": 1,\n");
+#if defined(__VERSION__)
+	printf("  \"compiler\": \"%s\",\n", __VERSION__);
+#elif defined(_MSC_VER)
+	printf("  \"compiler\": \"MSVC %d\",\n", _MSC_VER);
+#endif
+	Chip8 probe;
+	probe.setEngine(Chip8Engine::Jit);
+	printf("  \"jit\": %s,\n", probe.getEngine() == Chip8Engine::Jit ? "true" : "false");
+#if CHIP8_TRACE
+	printf("  \"trace\": true,\n");
+#endif
+#if CHIP8_PROFILE
+	printf("  \"profile\": true,\n");
+#endif
+	printf("  \"frames\": %llu,\n", frames);
+	printf("  \"cyclesPerFrame\": %u,\n", cyclesPerFrame);
+	printf("  \"repeats\": %d,\n", repeats);
+	bool ok = true;
+
+	// Whole ROMs: MIPS executing every instruction, and frames/second with idle loops skipped
+	printf("  \"roms\": [");
+	bool first = true;
+	for (const char * rom : roms) {
+		std::vector<unsigned char> data = readRom(std::string(romDir) + "/" + rom);
+		if (data.empty()) {
+			fprintf(stderr, "Could not read %s/%s\n", romDir, rom);
+			ok = false;
+			continue;
+		}
+
+		for (int e = 0; e < 3; ++e) {
+			double busy = 0, idle = 0;
+			unsigned long long hash = 0;
+			for (int r = 0; r < repeats; ++r) {
+				for (int skip = 0; skip < 2; ++skip) {
+					Chip8 c8;
+					c8.setEngine(engines[e]);
+					c8.cyclesPerFrame = cyclesPerFrame;
+					c8.skipIdle = skip != 0;
+					c8.loadApplication(data.data(), data.size());
+					c8.seedRandom(1);
+
+					auto start = std::chrono::steady_clock::now();
+					for (unsigned long long f = 0; f < frames; ++f) {
+						scriptKeys(c8, f);
+						c8.runFrame();
+					}
+					double seconds = since(start);
+
+					double & best = skip ? idle : busy;
+					if (r == 0 || seconds < best)
+						best = seconds;
+					hash = c8.frameHash();
+				}
+			}
+
+			double mips = frames * cyclesPerFrame / busy / 1e6;
+			printf("%s\n    { \"rom\": \"%s\", \"engine\": \"%s\", \"mips\": %.2f, \"framesPerSecond\": %.0f, \"frameHash\": \"%016llx\" }",
+				first ? "" : ",", rom, engineNames[e], mips, frames / idle, hash);
+			fprintf(stderr, "%-12s %-12s %8.1f MIPS %10.0f frames/s\n", rom, engineNames[e], mips, frames / idle);
+			first = false;
+		}
+	}
+	printf("\n  ],\n");
+
+	// Handlers on their own, through the same function pointers the interpreter calls
+	printf("  \"handlers\": [");
+	first = true;
+	for (const Chip8HandlerBench & handler : handlers) {
+		double best = 0;
+		for (int r = 0; r < repeats; ++r) {
+			double seconds = timeHandler(handler.opcode, handlerCalls);
+			if (r == 0 || seconds < best)
+				best = seconds;
+		}
+
+		double ns = best / handlerCalls * 1e9;
+		printf("%s\n    { \"handler\": \"%s\", \"opcode\": \"%04X\", \"nsPerCall\": %.3f }", first ? "" : ",", handler.name, handler.opcode, ns);
+		fprintf(stderr, "%-12s %-12s %8.2f ns\n", handler.name, "handler", ns);
+		first = false;
+	}
+	printf("\n  ],\n");
+
+	// Synthetic ROMs, no idle loops to skip
+	printf("  \"mixes\": [");
+	first = true;
+	for (const Chip8Mix & mix : mixes) {
+		std::vector<unsigned char> data = buildMix(mix);
+		for (int e = 0; e < 3; ++e) {
+			double best = 0;
+			unsigned long long hash = 0;
+			for (int r = 0; r < repeats; ++r) {
+				Chip8 c8;
+				c8.setEngine(engines[e]);
+				c8.skipIdle = false;
+				c8.loadApplication(data.data(), data.size());
+				c8.seedRandom(1);
+
+				auto start = std::chrono::steady_clock::now();
+				c8.runCycles(mixCycles);
+				double seconds = since(start);
+				if (r == 0 || seconds < best)
+					best = seconds;
+				hash = c8.frameHash();
+			}
+
+			double mips = mixCycles / best / 1e6;
+			printf("%s\n    { \"mix\": \"%s\", \"engine\": \"%s\", \"mips\": %.2f, \"frameHash\": \"%016llx\" }",
+				first ? "" : ",", mix.name, engineNames[e], mips, hash);
+			fprintf(stderr, "%-12s %-12s %8.1f MIPS\n", mix.name, engineNames[e], mips);
+			first = false;
+		}
+	}
+	printf("\n  ]\n}\n");
+
+	return ok ? 0 : 1;
+}
@@ -1,7 +1,38 @@
 #include "Chip8.h"
+#include "Chip8BlockCache.h"
+#include "Chip8Instructions.h"
+#include "Chip8Jit.h"
+#include "Chip8State.h"
+#if CHIP8_TRACE
+#include "Chip8Trace.h"
+#endif
+#if CHIP8_PROFILE
+#include "Chip8Profile.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <atomic>
+#include <new>
+
+// Tracing is compiled out unless CHIP8_TRACE is defined
+#if CHIP8_TRACE
+#define TRACE_OP(opcode) if (tracer) traceOp(opcode)
+#define TRACING (tracer != nullptr)
+#else
+#define TRACE_OP(opcode)
+#define TRACING false
+#endif
+
+// So is profiling, unless CHIP8_PROFILE is defined
+#if CHIP8_PROFILE
+#define PROFILE_OP(opcode) if (profiler) profiler->record(pc, opcode)
+#define PROFILING (profiler != nullptr)
+#else
+#define PROFILE_OP(opcode)
+#define PROFILING false
+#endif
 
 unsigned char chip8_fontset[80] =
 {
@@ -23,12 +54,65 @@ unsigned char chip8_fontset[80] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-Chip8::Chip8() {
+// Fontset and nothing else, what every instance starts from before an application is loaded
+static const std::shared_ptr<const Chip8Image> & blankImage() {
+	static const std::shared_ptr<const Chip8Image> blank = Chip8Image::create(NULL, 0);
+	return blank;
+}
 
+Chip8::Chip8() : cyclesPerFrame(10), skipIdle(true), idleCycles(0), unknownOpcodes(0), frames(0), privatePages(0), engine(Chip8Engine::Interpreter) {
+	attach(blankImage());
+	setQuirks(Chip8Quirks::Default);
 }
 
 Chip8::~Chip8() {
+	releasePages();
+}
+
+std::shared_ptr<const Chip8Image> Chip8Image::create(const unsigned char * data, size_t size) {
+	if (size > 4096 - 512)
+		return NULL;
+
+	std::shared_ptr<Chip8Image> image(new Chip8Image());
+	memset(image->bytes, 0, sizeof(image->bytes));
+	memcpy(image->bytes, chip8_fontset, sizeof(chip8_fontset));
+	if (size > 0)
+		memcpy(image->bytes + 512, data, size);
+	return image;
+}
+
+// Points every page at the image, dropping any copies made from the previous one
+void Chip8::attach(std::shared_ptr<const Chip8Image> image) {
+	releasePages();
+	this->image = std::move(image);
+	for (int i = 0; i < 64; ++i)
+		pages[i] = this->image->bytes + i * 64;
+}
 
+void Chip8::releasePages() {
+	for (int i = 0; i < 64; ++i) {
+		if ((privatePages >> i) & 1)
+			::operator delete((void*)pages[i], std::align_val_t(64));
+	}
+	privatePages = 0;
+}
+
+// Copies the page out of the shared image the first time it is written
+unsigned char * Chip8::writablePage(unsigned int page) {
+	if (((privatePages >> page) & 1) == 0) {
+		unsigned char * copy = (unsigned char*)::operator new(64, std::align_val_t(64));
+		memcpy(copy, pages[page], 64);
+		pages[page] = copy;
+		privatePages |= 1ULL << page;
+	}
+	return const_cast<unsigned char*>(pages[page]);
+}
+
+unsigned int Chip8::copiedPages() const {
+	unsigned int count = 0;
+	for (uint64_t copied = privatePages; copied != 0; copied &= copied - 1)
+		++count;
+	return count;
 }
 
 // When setting up Chip 8 make sure everything is cleared and reset
@@ -39,8 +123,12 @@ void Chip8::init() {
 	sp = 0;			// Reset stack pointer
 
 	// Clear pixels
-	for (int i = 0; i < 2048; ++i)
-		pixels[i] = 0x0;
+	for (int i = 0; i < 32; ++i)
+		screen[i] = 0;
+
+	// Nothing is known to match a snapshot taken before this
+	writtenPages = ~0ULL;
+	writtenRows = 0xFFFFFFFF;
 
 	// Clear stack
 	for (int i = 0; i < 16; ++i)
@@ -49,13 +137,14 @@ void Chip8::init() {
 	for (int i = 0; i < 16; ++i)
 		key[i] = V[i] = 0;
 
-	// Clear memory
-	for (int i = 0; i < 4096; ++i)
-		memory[i] = 0;
+	// Clear memory and load the fontset
+	attach(blankImage());
 
-	// Load fontset into memory
-	for (int i = 0; i < 80; ++i)
-		memory[i] = chip8_fontset[i];
+	// Nothing decoded from the old memory is valid anymore
+	if (blockCache)
+		blockCache->flush();
+	if (jit)
+		jit->reset();
 
 	// Reset timers
 	delay_timer = 0;
@@ -66,197 +155,152 @@ void Chip8::init() {
 
 	playBeep = false;
 
-	srand(time(NULL));
-}
-
-void Chip8::fetch()
-{
-	opcode = memory[pc] << 8 | memory[pc + 1];
-	printf("opcode %X\n", opcode);
+	idleCycles = 0;
+	unknownOpcodes = 0;
+	frames = 0;
+	presents = 0;
+	skippedPresents = 0;
+	presentedHash = ~frameHash();
 
+	// Unseeded instances still get different sequences from each other
+	static std::atomic<uint64_t> instanceCounter(0);
+	seedRandom((uint64_t)time(NULL) ^ (++instanceCounter * 0x9E3779B97F4A7C15ULL));
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////
+// Every instance has its own generator state, so instances never share or contend on rand()
+void Chip8::seedRandom(uint64_t seed) {
+	this->seed = seed;
 
-void Chip8::cpuNULL()
-{
-	// Do Nothing
-	printf("Unimplemented opcode %X\n", opcode);
-}
-void Chip8::cpuARITHMETIC() {
-	//Chip8Arithmetic[(opcode & 0x000F)];
+	// splitmix64 spreads the seed over the state and never leaves it zero
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	rngState = (z ^ (z >> 31)) | 1;
 }
 
-void Chip8::cpuRetClear() {
-	//Chip8RetClear[(opcode & 0x000F)];
+// xorshift64*, returns the top byte
+unsigned char Chip8::nextRandom() {
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return (unsigned char)((rngState * 0x2545F4914F6CDD1DULL) >> 56);
 }
-void Chip8::cpuKEYS() {
-	//Chip8Keys[(opcode & 0x000F)];
 
+// Every write to memory goes through here so decoded blocks covering the address are dropped
+void Chip8::store(unsigned short address, unsigned char value) {
+	address &= 0xFFF;
+	writablePage(address >> 6)[address & 63] = value;
+	writtenPages |= 1ULL << (address >> 6);
+	if (blockCache)
+		blockCache->invalidate(address);
 }
 
-void Chip8::cpuTimerMem1() {
-	//Chip8TimerMem1[(opcode & 0x00F0) >> 4];
-}
+// The classic instructions. Their bodies are shared with Chip8Extended in Chip8Instructions.h,
+// only the framebuffer ones are here.
 
-void Chip8::cpuTimerMem2() {
-	//Chip8TimerMem1[(opcode & 0x000F)];
+void Chip8::unknownOp(const Chip8Op&) {
+	Chip8Instructions::unknownOp(*this);
 }
 
 // 0x00E0: Clears the screen
-void Chip8::dispClear() {
-	for (int i = 0; i < 2048; ++i)
-		pixels[i] = 0x0;
+void Chip8::dispClear(const Chip8Op&) {
+	for (int i = 0; i < 32; ++i) {
+		if (screen[i] != 0)
+			writtenRows |= 1u << i;
+		screen[i] = 0;
+	}
 	drawFlag = true;
 	pc += 2;
 }
 
-// 0x00EE: Returns from subroutine
-void Chip8::retFromSub() {
-	--sp;			// 16 levels of stack, decrease stack pointer to prevent overwrite
-	pc = stack[sp]; // Put the stored return address from the stack back into the program counter
-	pc += 2;
+void Chip8::retFromSub(const Chip8Op&) {
+	Chip8Instructions::retFromSub(*this);
 }
 
-// 0x1NNN: Jumps to address NNN
-void Chip8::jump() {
-	pc = opcode & 0x0FFF;
+void Chip8::jump(const Chip8Op& op) {
+	Chip8Instructions::jump(*this, op);
 }
 
-// 0x2NNN: Calls subroutine at NNN
-void Chip8::callSub() {
-	stack[sp] = pc;	// Store current address in stack
-	++sp;			// Increment stack pointer
-	pc = opcode & 0x0FFF;	// Set the program counter to address NNN
+void Chip8::callSub(const Chip8Op& op) {
+	Chip8Instructions::callSub(*this, op);
 }
 
-// 0x3NNN: Skips the next instruction if V[X] equals NN
-void Chip8::skipVXisNN() {
-	if (V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
-		pc += 4; // Skip
-	else
-		pc += 2; // Normal
+void Chip8::skipVXisNN(const Chip8Op& op) {
+	Chip8Instructions::skipVXisNN(*this, op);
 }
 
-// 0x4XNN: Skips the next instruction if V[X] doesn't equal NN
-void Chip8::skipVXnotNN() {
-	if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
-		pc += 4; // Skip
-	else
-		pc += 2; // Normal
+void Chip8::skipVXnotNN(const Chip8Op& op) {
+	Chip8Instructions::skipVXnotNN(*this, op);
 }
 
-// 0x5XY0: Skips the next instruction if V[X] equals V[Y]
-void Chip8::skipVXisVY() {
-	if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
-		pc += 4; // Skip
-	else
-		pc += 2; // Normal
+void Chip8::skipVXisVY(const Chip8Op& op) {
+	Chip8Instructions::skipVXisVY(*this, op);
 }
 
-// 0x6XNN: Sets V[X] to NN
-void Chip8::setVXtoNN() {
-	V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-	pc += 2;
+void Chip8::setVXtoNN(const Chip8Op& op) {
+	Chip8Instructions::setVXtoNN(*this, op);
 }
 
-// 0x7XNN: Adds NN to VX
-void Chip8::addVXNN() {
-	V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-	pc += 2;
+void Chip8::addVXNN(const Chip8Op& op) {
+	Chip8Instructions::addVXNN(*this, op);
 }
 
-// 0x8XY0: Sets V[X] to the value of V[Y]
-void Chip8::setVXtoVY() {
-	V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-	pc += 2;
+void Chip8::setVXtoVY(const Chip8Op& op) {
+	Chip8Instructions::setVXtoVY(*this, op);
 }
 
-// 0x8XY1: Sets V[X] to V[X] or V[Y]
-void Chip8::VXorVY() {
-	V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
-	pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::VXorVY(const Chip8Op& op) {
+	Chip8Instructions::VXorVY<Chip8QuirkSet::of(Quirks).logicResetsVF>(*this, op);
 }
 
-// 0x8XY2: Sets V[X] to V[X] and V[Y]
-void Chip8::VXandVY() {
-	V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
-	pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::VXandVY(const Chip8Op& op) {
+	Chip8Instructions::VXandVY<Chip8QuirkSet::of(Quirks).logicResetsVF>(*this, op);
 }
 
-// 0x8XY3: Sets V[X] to V[X] xor V[Y]
-void Chip8::VXxorXY() {
-	V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
-	pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::VXxorXY(const Chip8Op& op) {
+	Chip8Instructions::VXxorXY<Chip8QuirkSet::of(Quirks).logicResetsVF>(*this, op);
 }
 
-// 0x8XY4: Adds V[Y] to V[X]. V[F] is set to 1 when there's a carry and to 0 when there isn't
-void Chip8::addVXVY() {
-	if (V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8])) // Check for carry
-		V[0xF] = 1; // Set that there is a carry
-	else
-		V[0xF] = 0; // Set that there isn't a carry
-	V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4]; // V[X] = V[X] + V[Y]
-	pc += 2;
+void Chip8::addVXVY(const Chip8Op& op) {
+	Chip8Instructions::addVXVY(*this, op);
 }
 
-// 0x8XY5: V[Y] is subtracted from V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
-void Chip8::subVXVY() {
-	if (V[(opcode & 0x00F0) >> 4] > V[(opcode & 0x0F00) >> 8]) // Check for borrow
-		V[0xF] = 0; // Set that there is a borrow
-	else
-		V[0xF] = 1; // Set that there isn't a borrow
-	V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4]; // V[X] = V[X] - V[Y]
-	pc += 2;
+void Chip8::subVXVY(const Chip8Op& op) {
+	Chip8Instructions::subVXVY(*this, op);
 }
 
-// 0x8XY6: Shifts V[X] right by one. V[F] is set to the value of the least significant bit of V[X] before the shift
-void Chip8::rightShift() {
-	V[0xF] = V[(opcode & 0x0F00) >> 8] & 0x1; // Set the LSB
-	V[(opcode & 0x0F00) >> 8] >>= 1;
-	pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::rightShift(const Chip8Op& op) {
+	Chip8Instructions::rightShift<Chip8QuirkSet::of(Quirks).shiftReadsVY>(*this, op);
 }
 
-// 0x8XY7: Sets V[X] to V[Y] minus V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
-void Chip8::subVYVX() {
-	if (V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x00F0) >> 4])	// Check for borrow
-		V[0xF] = 0; // Set that there is a borrow
-	else
-		V[0xF] = 1;	// Set that there ins't a borrow
-	V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8]; // V[X] = V[Y] - V[X]
-	pc += 2;
+void Chip8::subVYVX(const Chip8Op& op) {
+	Chip8Instructions::subVYVX(*this, op);
 }
 
-// 0x8XYE: Shifts V[X] left by one. V[F] is set to the value of the most significant bit before shift.
-void Chip8::leftShift() {
-	V[0xF] = V[(opcode & 0x0F00) >> 8] >> 7; // Set V[F] to MSB
-	V[(opcode & 0x0F00) >> 7] <<= 1;
-	pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::leftShift(const Chip8Op& op) {
+	Chip8Instructions::leftShift<Chip8QuirkSet::of(Quirks).shiftReadsVY>(*this, op);
 }
 
-// 0x9XY0: Skips the next instruction if V[X] doesn't equal V[Y]
-void Chip8::skipVXisntVY() {
-	if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
-		pc += 4;
-	else
-		pc += 2;
+void Chip8::skipVXisntVY(const Chip8Op& op) {
+	Chip8Instructions::skipVXisntVY(*this, op);
 }
 
-// ANNN: Sets I to the address of NNN
-void Chip8::setAddr() {
-	I = opcode & 0x0FFF;
-	pc += 2;
+void Chip8::setAddr(const Chip8Op& op) {
+	Chip8Instructions::setAddr(*this, op);
 }
 
-// BNNN: Jumps to the address NNN plus V[0]
-void Chip8::jumpV0() {
-	pc = (opcode & 0x0FFF) + V[0];
+template <Chip8Quirks Quirks>
+void Chip8::jumpV0(const Chip8Op& op) {
+	Chip8Instructions::jumpV0<Chip8QuirkSet::of(Quirks).jumpUsesVX>(*this, op);
 }
 
-// CXNN: Sets V[X] to a random number and NN
-void Chip8::random() {
-	V[(opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (opcode & 0x00FF);
-	pc += 2;
+void Chip8::random(const Chip8Op& op) {
+	Chip8Instructions::random(*this, op);
 }
 
 /* DXYN: Draws a sprite at the coordinates(V[X], V[Y]) that has a width of 8 pixels and a height of N pixels.
@@ -265,171 +309,422 @@ I value doesn't change after the execution of this instruction
 VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if it
 doesn't happen
 */
-void Chip8::disp() {
-	{
-		unsigned short x = V[(opcode & 0x0F00) >> 8];
-		unsigned short y = V[(opcode & 0x00F0) >> 4];
-		unsigned short height = opcode & 0x000F;
-		unsigned short pixel;
-
-		V[0xF] = 0;
-		for (int yline = 0; yline < height; yline++) {
-			pixel = memory[I + yline];
-			for (int xline = 0; xline < 8; xline++) {
-				if ((pixel & (0x80 >> xline)) != 0) {
-					if (pixels[(x + xline + ((y + yline) * 64))] == 1) {
-						V[0xF] = 1;
-					}
-					pixels[x + xline + ((y + yline) * 64)] ^= 1;
-				}
-			}
-		}
-		drawFlag = true;
-		pc += 2;
+template <Chip8Quirks Quirks>
+void Chip8::disp(const Chip8Op& op) {
+	constexpr bool clip = Chip8QuirkSet::of(Quirks).clipSprites;
+
+	// The starting position wraps around the screen. A sprite drawn over the edge wraps too,
+	// unless the profile clips it
+	unsigned int x = V[op.x] & 63;
+	unsigned int y = V[op.y] & 31;
+	int height = clip && y + op.n > 32 ? 32 - y : op.n;
+	uint64_t collision = 0;
+
+	for (int yline = 0; yline < height; yline++) {
+		// Shift the sprite row into place, rotating it so pixels past the right edge wrap to the left
+		uint64_t row = (uint64_t)read(I + yline) << 56;
+		if constexpr (clip)
+			row >>= x;
+		else
+			row = (row >> x) | (row << ((64 - x) & 63));
+
+		uint64_t & line = screen[(y + yline) & 31];
+		collision |= line & row;
+		line ^= row;
 	}
-}
 
-// EX9E: Skips the next instruction if the key stored in V[X] is pressed
-void Chip8::checkKeyDown() {
-	if (key[V[(opcode & 0x0F00) >> 8]] != 0)
-		pc += 4;
+	// Rows y to y + N - 1, wrapping around the bottom or cut off there
+	uint32_t rows = (uint32_t)((1ULL << op.n) - 1);
+	if constexpr (clip)
+		rows <<= y;
 	else
-		pc += 2;
+		rows = (rows << y) | (rows >> ((32 - y) & 31));
+	writtenRows |= rows;
+
+	V[0xF] = collision != 0;
+	drawFlag = true;
+	pc += 2;
 }
 
-// EXA1: Skips the next instruction if the key stored in V[X] isn't pressed
-void Chip8::checkKeyUp() {
-	if (key[V[(opcode & 0x0F00) >> 8]] == 0)
-		pc += 4;
-	else
-		pc += 2;
+void Chip8::checkKeyDown(const Chip8Op& op) {
+	Chip8Instructions::checkKeyDown(*this, op);
 }
 
-// FX07: Sets V[X] to the value of the delay timer
-void Chip8::getDelay() {
-	V[(opcode & 0x0F00) >> 8] = delay_timer;
-	pc += 2;
+void Chip8::checkKeyUp(const Chip8Op& op) {
+	Chip8Instructions::checkKeyUp(*this, op);
 }
 
-// FX0A: A key press is awaited, and then stored in V[X]
-void Chip8::awaitKey() {
-	{
-		bool keyPress = false;
-		for (int i = 0; i < 16; ++i) {
-			if (key[i] != 0) {
-				V[(opcode & 0x0F00) >> 8] = i;
-				keyPress = true;
-			}
+void Chip8::getDelay(const Chip8Op& op) {
+	Chip8Instructions::getDelay(*this, op);
+}
+
+void Chip8::awaitKey(const Chip8Op& op) {
+	Chip8Instructions::awaitKey(*this, op);
+}
+
+void Chip8::setDelay(const Chip8Op& op) {
+	Chip8Instructions::setDelay(*this, op);
+}
+
+void Chip8::setSound(const Chip8Op& op) {
+	Chip8Instructions::setSound(*this, op);
+}
+
+template <Chip8Quirks Quirks>
+void Chip8::addIVX(const Chip8Op& op) {
+	Chip8Instructions::addIVX<Chip8QuirkSet::of(Quirks).addIFlagsOverflow>(*this, op);
+}
+
+void Chip8::spriteAddr(const Chip8Op& op) {
+	Chip8Instructions::spriteAddr(*this, op);
+}
+
+void Chip8::setBCD(const Chip8Op& op) {
+	Chip8Instructions::setBCD(*this, op);
+}
+
+template <Chip8Quirks Quirks>
+void Chip8::regDump(const Chip8Op& op) {
+	Chip8Instructions::regDump<Chip8QuirkSet::of(Quirks).memory>(*this, op);
+}
+
+template <Chip8Quirks Quirks>
+void Chip8::regLoad(const Chip8Op& op) {
+	Chip8Instructions::regLoad<Chip8QuirkSet::of(Quirks).memory>(*this, op);
+}
+////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every handler, in the order of a profile's handler table
+enum class Chip8Handler : unsigned char {
+	UnknownOp, DispClear, RetFromSub, Jump, CallSub, SkipVXisNN, SkipVXnotNN, SkipVXisVY, SetVXtoNN, AddVXNN,
+	SetVXtoVY, VXorVY, VXandVY, VXxorXY, AddVXVY, SubVXVY, RightShift, SubVYVX, LeftShift,
+	SkipVXisntVY, SetAddr, JumpV0, Random, Disp, CheckKeyDown, CheckKeyUp,
+	GetDelay, AwaitKey, SetDelay, SetSound, AddIVX, SpriteAddr, SetBCD, RegDump, RegLoad,
+	Count
+};
+
+// Which handler runs a single opcode. The same for every quirk profile.
+static constexpr Chip8Handler decodeHandler(unsigned short opcode) {
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00E0)		return Chip8Handler::DispClear;
+		if (opcode == 0x00EE)		return Chip8Handler::RetFromSub;
+		break;
+	case 0x1000: return Chip8Handler::Jump;
+	case 0x2000: return Chip8Handler::CallSub;
+	case 0x3000: return Chip8Handler::SkipVXisNN;
+	case 0x4000: return Chip8Handler::SkipVXnotNN;
+	case 0x5000: return Chip8Handler::SkipVXisVY;
+	case 0x6000: return Chip8Handler::SetVXtoNN;
+	case 0x7000: return Chip8Handler::AddVXNN;
+	case 0x8000:
+		switch (opcode & 0x000F) {
+		case 0x0000: return Chip8Handler::SetVXtoVY;
+		case 0x0001: return Chip8Handler::VXorVY;
+		case 0x0002: return Chip8Handler::VXandVY;
+		case 0x0003: return Chip8Handler::VXxorXY;
+		case 0x0004: return Chip8Handler::AddVXVY;
+		case 0x0005: return Chip8Handler::SubVXVY;
+		case 0x0006: return Chip8Handler::RightShift;
+		case 0x0007: return Chip8Handler::SubVYVX;
+		case 0x000E: return Chip8Handler::LeftShift;
+		}
+		break;
+	case 0x9000: return Chip8Handler::SkipVXisntVY;
+	case 0xA000: return Chip8Handler::SetAddr;
+	case 0xB000: return Chip8Handler::JumpV0;
+	case 0xC000: return Chip8Handler::Random;
+	case 0xD000: return Chip8Handler::Disp;
+	case 0xE000:
+		if ((opcode & 0x00FF) == 0x009E)		return Chip8Handler::CheckKeyDown;
+		if ((opcode & 0x00FF) == 0x00A1)		return Chip8Handler::CheckKeyUp;
+		break;
+	case 0xF000:
+		switch (opcode & 0x00FF) {
+		case 0x0007: return Chip8Handler::GetDelay;
+		case 0x000A: return Chip8Handler::AwaitKey;
+		case 0x0015: return Chip8Handler::SetDelay;
+		case 0x0018: return Chip8Handler::SetSound;
+		case 0x001E: return Chip8Handler::AddIVX;
+		case 0x0029: return Chip8Handler::SpriteAddr;
+		case 0x0033: return Chip8Handler::SetBCD;
+		case 0x0055: return Chip8Handler::RegDump;
+		case 0x0065: return Chip8Handler::RegLoad;
 		}
+		break;
+	}
+	return Chip8Handler::UnknownOp;
+}
 
-		// If we didn't get a keypress skip this cycle and try again
-		if (!keyPress)
-			return;
+// Every possible opcode decoded at compile time into a one byte handler index. 64KB shared
+// by all profiles, where a full Chip8Op per opcode took 1MB per profile and missed the cache.
+struct Chip8DecodeTable {
+	unsigned char handler[0x10000];
 
-		pc += 2;
+	constexpr Chip8DecodeTable() : handler() {
+		for (unsigned int i = 0; i < 0x10000; ++i)
+			handler[i] = (unsigned char)decodeHandler((unsigned short)i);
+	}
+};
+
+static constexpr Chip8DecodeTable decodeTable;
+
+// Handlers compiled for one quirk profile, indexed by Chip8Handler
+template <Chip8Quirks Quirks>
+struct Chip8OpTable {
+	static constexpr Chip8Exec handlers[(int)Chip8Handler::Count] = {
+		&Chip8::call<&Chip8::unknownOp>,
+		&Chip8::call<&Chip8::dispClear>,
+		&Chip8::call<&Chip8::retFromSub>,
+		&Chip8::call<&Chip8::jump>,
+		&Chip8::call<&Chip8::callSub>,
+		&Chip8::call<&Chip8::skipVXisNN>,
+		&Chip8::call<&Chip8::skipVXnotNN>,
+		&Chip8::call<&Chip8::skipVXisVY>,
+		&Chip8::call<&Chip8::setVXtoNN>,
+		&Chip8::call<&Chip8::addVXNN>,
+		&Chip8::call<&Chip8::setVXtoVY>,
+		&Chip8::call<&Chip8::VXorVY<Quirks>>,
+		&Chip8::call<&Chip8::VXandVY<Quirks>>,
+		&Chip8::call<&Chip8::VXxorXY<Quirks>>,
+		&Chip8::call<&Chip8::addVXVY>,
+		&Chip8::call<&Chip8::subVXVY>,
+		&Chip8::call<&Chip8::rightShift<Quirks>>,
+		&Chip8::call<&Chip8::subVYVX>,
+		&Chip8::call<&Chip8::leftShift<Quirks>>,
+		&Chip8::call<&Chip8::skipVXisntVY>,
+		&Chip8::call<&Chip8::setAddr>,
+		&Chip8::call<&Chip8::jumpV0<Quirks>>,
+		&Chip8::call<&Chip8::random>,
+		&Chip8::call<&Chip8::disp<Quirks>>,
+		&Chip8::call<&Chip8::checkKeyDown>,
+		&Chip8::call<&Chip8::checkKeyUp>,
+		&Chip8::call<&Chip8::getDelay>,
+		&Chip8::call<&Chip8::awaitKey>,
+		&Chip8::call<&Chip8::setDelay>,
+		&Chip8::call<&Chip8::setSound>,
+		&Chip8::call<&Chip8::addIVX<Quirks>>,
+		&Chip8::call<&Chip8::spriteAddr>,
+		&Chip8::call<&Chip8::setBCD>,
+		&Chip8::call<&Chip8::regDump<Quirks>>,
+		&Chip8::call<&Chip8::regLoad<Quirks>>
+	};
+};
+
+static const Chip8Exec * handlerTable(Chip8Quirks quirks) {
+	switch (quirks) {
+	case Chip8Quirks::Vip:			return Chip8OpTable<Chip8Quirks::Vip>::handlers;
+	case Chip8Quirks::Chip48:		return Chip8OpTable<Chip8Quirks::Chip48>::handlers;
+	case Chip8Quirks::SuperChip:	return Chip8OpTable<Chip8Quirks::SuperChip>::handlers;
+	default:						return Chip8OpTable<Chip8Quirks::Default>::handlers;
 	}
 }
 
-// FX15: Sets the delay timer to V[X]
-void Chip8::setDelay() {
-	delay_timer = V[(opcode & 0x0F00) >> 8];
-	pc += 2;
+// The handler from the table plus the operands, which are a few shifts and masks of the opcode
+static inline Chip8Op decodeWith(const Chip8Exec * handlers, unsigned short opcode) {
+	return Chip8Op{ handlers[decodeTable.handler[opcode]], opcode, (unsigned short)(opcode & 0x0FFF),
+		(unsigned char)((opcode & 0x0F00) >> 8), (unsigned char)((opcode & 0x00F0) >> 4),
+		(unsigned char)(opcode & 0x000F), (unsigned char)(opcode & 0x00FF) };
 }
 
-// FX18: Sets the sound timer to V[X]
-void Chip8::setSound() {
-	sound_timer = V[(opcode & 0x0F00) >> 8];
-	pc += 2;
+Chip8Op Chip8::decode(unsigned short opcode, Chip8Quirks quirks) {
+	return decodeWith(handlerTable(quirks), opcode);
 }
 
-// FX1E: Adds V[X] to I
-void Chip8::addIVX() {
-	if (I + V[(opcode & 0x0F00) >> 8] > 0xFFF) // V[F] is set to 1 when range overflow and 0 when it isn't
-		V[0xF] = 1;
-	else
-		V[0xF] = 0;
-	I += V[(opcode & 0x0F00) >> 8];
-	pc += 2;
+Chip8Op Chip8::decodeOp(unsigned short opcode) const {
+	return decodeWith(handlers, opcode);
+}
+
+void Chip8::emulateCycle() {
+	// Fetch opcode (since opcodes are 2 bytes must grab 2 bytes)
+	opcode = readOpcode(pc);
 
+	// Decode and execute
+	const Chip8Op op = decodeWith(handlers, opcode);
+	TRACE_OP(opcode);
+	PROFILE_OP(opcode);
+	op.exec(*this, op);
 }
 
-// FX29: Sets I to the location of the sprite for the character in V[X]. Characters 0-F (in hexadecimal) are represented by a 4x5 font
-void Chip8::spriteAddr() {
-	I = V[(opcode & 0x0F00) >> 8] * 0x5;
-	pc += 2;
+// Instructions that can do anything other than advance pc by 2 end a decoded block.
+// Memory writes end one too, so a block that overwrites itself is never run stale.
+bool Chip8::endsBlock(const Chip8Op& op) {
+	return op.exec == &call<&Chip8::unknownOp>
+		|| op.exec == &call<&Chip8::retFromSub>
+		|| op.exec == &call<&Chip8::jump>
+		|| op.exec == &call<&Chip8::callSub>
+		|| op.exec == &call<&Chip8::skipVXisNN>
+		|| op.exec == &call<&Chip8::skipVXnotNN>
+		|| op.exec == &call<&Chip8::skipVXisVY>
+		|| op.exec == &call<&Chip8::skipVXisntVY>
+		|| op.exec == &call<&Chip8::checkKeyDown>
+		|| op.exec == &call<&Chip8::checkKeyUp>
+		|| op.exec == &call<&Chip8::awaitKey>
+		|| op.exec == &call<&Chip8::setBCD>
+		|| quirkEndsBlock<Chip8Quirks::Default>(op)
+		|| quirkEndsBlock<Chip8Quirks::Vip>(op)
+		|| quirkEndsBlock<Chip8Quirks::Chip48>(op)
+		|| quirkEndsBlock<Chip8Quirks::SuperChip>(op);
 }
 
-// FX33: Stores the binary coded decimal representation of V[X] at the address I, I+1 and I+2
-void Chip8::setBCD() {
-	memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-	memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-	memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
-	pc += 2;
+template <Chip8Quirks Quirks>
+bool Chip8::quirkEndsBlock(const Chip8Op& op) {
+	return op.exec == &call<&Chip8::jumpV0<Quirks>>
+		|| op.exec == &call<&Chip8::regDump<Quirks>>;
 }
 
-// FX55: Stores V[0] to V[X] in memory starting at address I
-void Chip8::regDump() {
-	for (int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i)
-		memory[I + 1] = V[i];
+// Falls back to the block cache when the JIT isn't supported on this host
+void Chip8::setEngine(Chip8Engine engine) {
+	if (engine == Chip8Engine::Jit && !Chip8Jit::available())
+		engine = Chip8Engine::Cached;
 
-	// On the original interpreter, when the operation is done, I = I + X + 1.
-	I += ((opcode & 0x0F00) >> 8) + 1;
-	pc += 2;
+	this->engine = engine;
+	if (engine != Chip8Engine::Interpreter && !blockCache)
+		blockCache.reset(new Chip8BlockCache());
+	if (engine == Chip8Engine::Jit && !jit)
+		jit.reset(new Chip8Jit());
 }
 
-// FX65: Fills V[0] to V[X] with value from memory starting at address I
-void Chip8::regLoad() {
-	for (int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i)
-		V[i] = memory[I + i];
+Chip8Engine Chip8::getEngine() const {
+	return engine;
+}
 
-	// On the original interpreter, when the operation is done, I = I + X + 1.
-	I += ((opcode & 0x0F00) >> 8) + 1;
-	pc += 2;
+// Picks the dispatch table for the profile. Blocks decoded for another profile are dropped.
+void Chip8::setQuirks(Chip8Quirks quirks) {
+	this->quirks = quirks;
+	handlers = handlerTable(quirks);
+	if (blockCache)
+		blockCache->flush();
+	if (jit)
+		jit->reset();
 }
-/*
-void(*Chip8Table[16]) =
-{
-	cpuRetClear, jump, callSub, skipVXisNN, skipVXnotNN, skipVXisVY, setVXtoNN, addVXNN,
-	cpuARITHMETIC, skipVXisntVY, setAddr, jumpV0, random, disp, cpuKEYS, cpuTimerMem1
-};
 
-void(*Chip8Arithmetic[16]) =
-{
-	setVXtoVY, VXorVY, VXandVY, VXxorXY, addVXVY, subVXVY, rightShift, subVYVX,
-	cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, leftShift, cpuNULL
-};
+Chip8Quirks Chip8::getQuirks() const {
+	return quirks;
+}
 
-void(*Chip8RetClear[16]) =
-{
-	dispClear, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL,
-	cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, retFromSub, cpuNULL
-};
+// Nothing outside the core changes during runCycles: keys are only updated and timers only
+// tick in between calls. A loop that leaves the machine in the same state every pass can
+// therefore be skipped up to the end of the call. Returns the number of cycles skipped,
+// or 0 when pc isn't at the head of a recognised idle loop.
+unsigned long long Chip8::skipIdleLoop(unsigned long long cycles) {
+	unsigned short address = pc & 0xFFF;
+	unsigned short opcode = readOpcode(address);
+
+	// 1NNN: Jump to itself
+	if (opcode == (0x1000 | address)) {
+		idleCycles += cycles;
+		return cycles;
+	}
 
-void(*Chip8Keys[16]) =
-{
-	cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, checkKeyDown,
-	cpuNULL, cpuNULL, checkKeyUp, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL
-};
+	// FX0A: Waiting for a key that isn't down
+	if ((opcode & 0xF0FF) == 0xF00A) {
+		for (int i = 0; i < 16; ++i) {
+			if (key[i] != 0)
+				return 0;
+		}
+		idleCycles += cycles;
+		return cycles;
+	}
 
-void(*Chip8TimerMem1[16]) =
-{
-	cpuTimerMem2, cpuTimerMem2, spriteAddr, setBCD, cpuNULL, regDump, regLoad, cpuNULL,
-	cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL
-};
+	// FX07, 3XNN or 4XNN, 1NNN: Polling the delay timer until it reaches NN
+	if ((opcode & 0xF0FF) == 0xF007 && cycles >= 3) {
+		unsigned short test = readOpcode(address + 2);
+		unsigned short back = readOpcode(address + 4);
+		unsigned char x = (opcode & 0x0F00) >> 8;
+		unsigned char nn = test & 0x00FF;
+
+		if (back != (0x1000 | address) || ((test & 0x0F00) >> 8) != x)
+			return 0;
+
+		bool loops = ((test & 0xF000) == 0x3000 && delay_timer != nn)
+			|| ((test & 0xF000) == 0x4000 && delay_timer == nn);
+		if (!loops)
+			return 0;
+
+		// Every pass leaves V[X] holding the timer and pc back at the FX07
+		unsigned long long skipped = cycles - cycles % 3;
+		V[x] = delay_timer;
+		idleCycles += skipped;
+		return skipped;
+	}
 
-void(*Chip8TimerMem2[16]) =
-{
-	cpuNULL, cpuNULL, cpuNULL, cpuNULL, cpuNULL, setDelay, cpuNULL, getDelay,
-	setSound, cpuNULL, awaitKey, cpuNULL, cpuNULL, cpuNULL, addIVX, cpuNULL
-}; */
-////////////////////////////////////////////////////////////////////////////////////////////
+	return 0;
+}
 
+// Only jumps and FX0A/FX07 can start an idle loop, so everything else is rejected with one load
+inline bool Chip8::mayIdle() const {
+	unsigned char group = read(pc) & 0xF0;
+	return skipIdle && (group == 0x10 || group == 0xF0);
+}
 
-void Chip8::emulateCycle() {
+void Chip8::runCycles(unsigned long long cycles) {
+	if (engine == Chip8Engine::Interpreter) {
+		while (cycles > 0) {
+			if (mayIdle()) {
+				unsigned long long skipped = skipIdleLoop(cycles);
+				if (skipped > 0) {
+					cycles -= skipped;
+					continue;
+				}
+			}
+			emulateCycle();
+			--cycles;
+		}
+		return;
+	}
+
+	while (cycles > 0) {
+		if (mayIdle()) {
+			unsigned long long skipped = skipIdleLoop(cycles);
+			if (skipped > 0) {
+				cycles -= skipped;
+				continue;
+			}
+		}
+
+		Chip8Block & block = blockCache->fetch(*this, pc);
+
+		// Compiled blocks always run to the end, so they are only used when the whole block fits.
+		// They can't be traced or profiled either.
+		if (block.native != NULL && block.length <= cycles && !TRACING && !PROFILING) {
+			cycles -= block.length;
+			block.native(this);
+			continue;
+		}
+
+		// Tier up hot blocks, starting over with an empty cache once the code buffer is full
+		if (engine == Chip8Engine::Jit && block.native == NULL && ++block.hits == Chip8Jit::threshold) {
+			if (!jit->compile(*this, block, blockCache->ops(block))) {
+				blockCache->flush();
+				jit->reset();
+			}
+			continue;
+		}
+
+		const Chip8Op * op = blockCache->ops(block);
+		unsigned long long count = block.length < cycles ? block.length : cycles;
+		cycles -= count;
+
+		// Ops in a block run back-to-back without fetching or decoding
+		for (; count > 0; --count, ++op) {
+			TRACE_OP(op->opcode);
+			PROFILE_OP(op->opcode);
+			op->exec(*this, *op);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+// Reference decoder using a nested switch, kept to benchmark the dispatch table against.
+// It always runs the default quirk profile.
+void Chip8::emulateCycleSwitch() {
 
 	// Fetch opcode (since opcodes are 2 bytes must grab 2 bytes)
-	opcode = memory[pc] << 8 | memory[pc + 1];
-	// printf("opcode%X\n", opcode);
+	opcode = readOpcode(pc);
+	const Chip8Op op = { NULL, opcode, (unsigned short)(opcode & 0x0FFF), (unsigned char)((opcode & 0x0F00) >> 8),
+		(unsigned char)((opcode & 0x00F0) >> 4), (unsigned char)(opcode & 0x000F), (unsigned char)(opcode & 0x00FF) };
 
 	// Process opcode
 	// Check first hex value then so on
@@ -437,60 +732,60 @@ void Chip8::emulateCycle() {
 	{
 	// Begin case 0x0000
 	case 0x0000:
-		switch (opcode & 0x000F) {
-		case 0x000: // 0x00E0: Clears the screen
-			dispClear();
+		switch (opcode & 0x00FF) {
+		case 0x00E0: // 0x00E0: Clears the screen
+			dispClear(op);
 			break;
 
-		case 0x000E: // 0x00EE: Returns from subroutine
-			retFromSub();
+		case 0x00EE: // 0x00EE: Returns from subroutine
+			retFromSub(op);
 			break;
 
 		default:
-			printf("Unkown opcode [0x0000]: 0x%X\n", opcode);
+			unknownOp(op);
 		}
 	break;
 	// End case 0x000
 
 	//Begin case 0x1000
 	case 0x1000: // 0x1NNN: Jumps to address NNN
-		jump();
+		jump(op);
 		break;
 	// End case 0x1000
 	
 	// Begin case 0x2000
 	case 0x2000: // 0x2NNN: Calls subroutine at NNN
-		callSub();
+		callSub(op);
 		break;
 	// End case 0x2000
 
 	// Begin case 0x3000
 	case 0x3000: // 0x3NNN: Skips the next instruction if V[X] equals NN
-		skipVXisNN();
+		skipVXisNN(op);
 		break;
 	// End case 0x3000
 
 	// Begin case 0x4000
 	case 0x4000: // 0x4XNN: Skips the next instruction if V[X] doesn't equal NN
-		skipVXnotNN();
+		skipVXnotNN(op);
 		break;
 	// End case 0x4000
 
 	// Begin case 0x5000
 	case 0x5000: // 0x5XY0: Skips the next instruction if V[X] equals V[Y]
-		skipVXisVY();
+		skipVXisVY(op);
 		break;
 	// End case 0x5000
 
 	// Begin case 0x6000
 	case 0x6000: // 0x6XNN: Sets V[X] to NN
-		setVXtoNN();
+		setVXtoNN(op);
 		break;
 	// End case 0x6000
 
 	// Begin case 0x7000
 	case 0x7000: // 0x7XNN: Adds NN to VX
-		addVXNN();
+		addVXNN(op);
 		break;
 	// End case 0x7000
 
@@ -500,85 +795,85 @@ void Chip8::emulateCycle() {
 
 		// Begin case 0x8XY0
 		case 0x000: // 0x8XY0: Sets V[X] to the value of V[Y]
-			setVXtoVY();
+			setVXtoVY(op);
 			break;
 		// End case 0x8XY0
 
 		// Begin case 0x8XY1
 		case 0x0001: // 0x8XY1: Sets V[X] to V[X] or V[Y]
-			VXorVY();
+			VXorVY<Chip8Quirks::Default>(op);
 			break;
 		// End case 0x8XY1
 
 		// Begin case 0x8XY2
 		case 0x0002: // 0x8XY2: Sets V[X] to V[X] and V[Y]
-			VXandVY();
+			VXandVY<Chip8Quirks::Default>(op);
 			break;
 		// End case 0x8XY2
 
 		// Begin case 0x8XY3
 		case 0x0003: // 0x8XY3: Sets V[X] to V[X] xor V[Y]
-			VXxorXY();
+			VXxorXY<Chip8Quirks::Default>(op);
 			break;
 		// End case 0x8XY3
 
 		// Begin case 0x8XY4
 		case 0x0004: // 0x8XY4: Adds V[Y] to V[X]. V[F] is set to 1 when there's a carry and to 0 when there isn't					
-			addVXVY();
+			addVXVY(op);
 			break;
 		// End case 0x8XY4
 
 		// Begin case 0x8XY5
 		case 0x0005: // 0x8XY5: V[Y] is subtracted from V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
-			subVXVY();
+			subVXVY(op);
 			break;
 		// End case 0x8XY5
 
 		// Begin case 0x8XY6
 		case 0x0006: // 0x8XY6: Shifts V[X] right by one. V[F] is set to the value of the least significant bit of V[X] before the shift
-			rightShift();
+			rightShift<Chip8Quirks::Default>(op);
 			break;
 		// End case 0x8XY6
 
 		// Begin case 0x8XY7
 		case 0x0007: // 0x8XY7: Sets V[X] to V[Y] minus V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
-			subVYVX();
+			subVYVX(op);
 			break;
 		// End case 0x8XY7
 
 		// Begin case 0x8XYE
 		case 0x000E: // 0x8XYE: Shifts V[X] left by one. V[F] is set to the value of the most significant bit before shift.
-			leftShift();
+			leftShift<Chip8Quirks::Default>(op);
 			break;
 		// End case 0x8XYE
 			
 		default:
-			printf("Unknown opcode [0x8000]: 0x%X\n", opcode);
+			unknownOp(op);
 		}
 		break;
 	// End case 0x8000
 
 	// Begin case 0x9000
 	case 0x9000: // 0x9XY0: Skips the next instruction if V[X] doesn't equal V[Y]
-		skipVXisntVY();
+		skipVXisntVY(op);
 		break;
 	// End case 0x9000
 
 	// Begin case 0xA000
 	case 0xA000: // ANNN: Sets I to the address of NNN
-		setAddr();
+		setAddr(op);
 		break;
 	// End case 0xA000
 
 	// Begin case 0xB000
 	case 0xB000: // BNNN: Jumps to the address NNN plus V[0]
-		jumpV0();
+		jumpV0<Chip8Quirks::Default>(op);
 		break;
 	// End case 0xB000
 
 	// Begin case 0xC000
 	case 0xC000: // CXNN: Sets V[X] to a random number and NN
-		random();
+		random(op);
 		break;
 	// End case 0xC000
 
@@ -589,7 +884,7 @@ void Chip8::emulateCycle() {
 					VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if it 
 					doesn't happen
 				 */
-		disp();
+		disp<Chip8Quirks::Default>(op);
 	break;
 	// End case 0xD000
 
@@ -598,17 +893,17 @@ void Chip8::emulateCycle() {
 		switch (opcode & 0x00FF) {
 		// Begin case 0xEX9E
 		case 0x009E: // EX9E: Skips the next instruction if the key stored in V[X] is pressed
-			checkKeyDown();
+			checkKeyDown(op);
 			break;
 		// End case 0xEX9E
 
 		// Begin case 0xEXA1
 		case 0x00A1: // EXA1: Skips the next instruction if the key stored in V[X] isn't pressed
-			checkKeyUp();
+			checkKeyUp(op);
 			break;
 		// End case 0xEXA1
 		default:
-			printf("Unknown opcode [0xE000]: 0x%X\n", opcode);
+			unknownOp(op);
 		}
 		break;
 	// End case 0xE000
@@ -617,68 +912,77 @@ void Chip8::emulateCycle() {
 		switch (opcode & 0x00FF) {
 		// Begin case FX07
 		case 0x0007: // FX07: Sets V[X] to the value of the delay timer
-			getDelay();
+			getDelay(op);
 			break;
 		// End case FX07
 
 		// Begin case FX0A
 		case 0x000A: // FX0A: A key press is awaited, and then stored in V[X]
-			awaitKey();
+			awaitKey(op);
 		break;
 		// End case FX0A
 		
 		// Begin case FX15
 		case 0x0015: // FX15: Sets the delay timer to V[X]
-			setDelay();
+			setDelay(op);
 			break;
 		// End case FX15
 
 		// Begin case FX18
 		case 0x0018: // FX18: Sets the sound timer to V[X]
-			setSound();
+			setSound(op);
 			break;
 		// End case FX18
 
 		// Begin case FX1E
 		case 0x001E: // FX1E: Adds V[X] to I
-			addIVX();
+			addIVX<Chip8Quirks::Default>(op);
 			break;
 		// End case FX1E
 
 		// Begin case FX29
 		case 0x0029: // FX29: Sets I to the location of the sprite for the character in V[X]. Characters 0-F (in hexadecimal) are represented by a 4x5 font
-			spriteAddr();
+			spriteAddr(op);
 			break;
 		// End case FX29
 
 		// Begin case FX33
 		case 0x0033: // FX33: Stores the binary coded decimal representation of V[X] at the address I, I+1 and I+2
-			setBCD();
+			setBCD(op);
 			break;
 		// End case FX33
 
 		// Begin case FX55
 		case 0x0055: // FX55: Stores V[0] to V[X] in memory starting at address I
-			regDump();
+			regDump<Chip8Quirks::Default>(op);
 			break;
 		// End case FX55
 
 		// Begin case FX65
 		case 0x0065: // FX65: Fills V[0] to V[X] with value from memory starting at address I
-			regLoad();
+			regLoad<Chip8Quirks::Default>(op);
 			break;
 		// End case FX65
 		default:
-			printf("Unknown opcode [0xF000]: 0x%X\n", opcode);
+			unknownOp(op);
 		}
 		break;
 	// End case 0xF000
 	default:
-		printf("Unknown opcode 0x%X\n", opcode);
+		unknownOp(op);
 	}
+}
 
-	// Update timers
+// Runs one 60 Hz frame: cyclesPerFrame instructions followed by a single timer update
+void Chip8::runFrame() {
+	runCycles(cyclesPerFrame);
+	endFrame();
+}
+
+// Ticks the timers at the end of a frame whose cycles were run in pieces
+void Chip8::endFrame() {
 	updateTimers();
+	++frames;
 }
 
 void Chip8::updateTimers() {
@@ -693,25 +997,195 @@ void Chip8::updateTimers() {
 	}
 }
 
-void Chip8::execute()
-{
-	//===================================
-	// Fetch Next Opcode And Execute It
-	//===================================
-	fetch();
-	printf("%X\n", (opcode & 0xF000) >> 12);
-	Chip8Table[(opcode & 0xF000) >> 12];
-	updateTimers();
+#if CHIP8_TRACE
+bool Chip8::startTrace(const char * filename) {
+	if (!tracer)
+		tracer.reset(new Chip8Tracer());
+	return tracer->start(filename);
+}
+
+unsigned long long Chip8::stopTrace() {
+	unsigned long long dropped = tracer ? tracer->stop() : 0;
+	tracer.reset();
+	return dropped;
+}
+
+void Chip8::traceOp(unsigned short opcode) {
+	Chip8TraceRecord r;
+	r.pc = pc;
+	r.opcode = opcode;
+	r.I = I;
+	r.sp = (uint8_t)sp;
+	r.delay_timer = delay_timer;
+	for (int i = 0; i < 16; ++i)
+		r.V[i] = V[i];
+	tracer->record(r);
 }
+#endif
+
+#if CHIP8_PROFILE
+Chip8Profiler & Chip8::startProfile() {
+	if (!profiler)
+		profiler.reset(new Chip8Profiler());
+	profiler->clear();
+	return *profiler;
+}
+
+void Chip8::stopProfile() {
+	profiler.reset();
+}
+#endif
+
+// FNV-1a hash of the framebuffer, used to compare runs without a front end
+unsigned long long Chip8::frameHash() const {
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < 32; ++i) {
+		hash ^= screen[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Games often erase and redraw sprites within a frame, setting drawFlag each time. Front ends
+// call this at the frame boundary instead, and only present when the pixels actually changed.
+bool Chip8::presentFrame() {
+	if (!drawFlag)
+		return false;
+	drawFlag = false;
+
+	unsigned long long hash = frameHash();
+	if (hash == presentedHash) {
+		++skippedPresents;
+		return false;
+	}
+	presentedHash = hash;
+	++presents;
+	return true;
+}
+
+// FNV-1a hash of all 4K of memory, identifies the loaded program
+unsigned long long Chip8::memoryHash() const {
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < 4096; ++i) {
+		hash ^= read(i);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+void Chip8::saveState(Chip8State& state) const {
+	memcpy(state.magic, "C8SS", 4);
+	state.version = 1;
+	state.pc = pc;
+	state.I = I;
+	state.sp = sp;
+	memcpy(state.stack, stack, sizeof(stack));
+	memcpy(state.V, V, sizeof(V));
+	state.delay_timer = delay_timer;
+	state.sound_timer = sound_timer;
+	state.reserved[0] = state.reserved[1] = 0;
+	state.rngState = rngState;
+	state.seed = seed;
+	state.frames = frames;
+	memcpy(state.screen, screen, sizeof(screen));
+	for (int i = 0; i < 64; ++i)
+		memcpy(state.memory + i * 64, pages[i], 64);
+}
+
+// Keys, engine and counters other than frames are left as they are
+void Chip8::loadState(const Chip8State& state) {
+	// Only pages that differ are copied out of the shared image. Decoded blocks only go stale
+	// if the memory differs, which it rarely does between frames.
+	bool changed = false;
+	for (int i = 0; i < 64; ++i) {
+		if (memcmp(pages[i], state.memory + i * 64, 64) != 0) {
+			memcpy(writablePage(i), state.memory + i * 64, 64);
+			changed = true;
+		}
+	}
+	if (changed) {
+		if (blockCache)
+			blockCache->flush();
+		if (jit)
+			jit->reset();
+	}
+	memcpy(screen, state.screen, sizeof(screen));
+	loadRegisters(state);
+
+	writtenPages = ~0ULL;
+	writtenRows = 0xFFFFFFFF;
+}
+
+// Saves the state and starts tracking the memory pages and rows written from here on
+void Chip8::snapshot(Chip8State& state) {
+	saveState(state);
+	writtenPages = 0;
+	writtenRows = 0;
+}
+
+// Goes back to the last snapshot taken from this instance, copying back only the memory pages
+// and framebuffer rows written since. Much cheaper than loadApplication or loadState when a
+// short run touched little memory, which is the usual case for fuzzing and search.
+void Chip8::resetTo(const Chip8State& state) {
+	for (uint64_t written = writtenPages; written != 0; written &= written - 1) {
+		unsigned int page = 0;
+		while (((written >> page) & 1) == 0)
+			++page;
+
+		unsigned short address = (unsigned short)(page * 64);
+		if (memcmp(pages[page], state.memory + address, 64) == 0)
+			continue;
+		if (blockCache) {
+			for (int i = 0; i < 64; ++i) {
+				if (pages[page][i] != state.memory[address + i])
+					blockCache->invalidate(address + i);
+			}
+		}
+		memcpy(writablePage(page), state.memory + address, 64);
+	}
+
+	for (int i = 0; i < 32; ++i) {
+		if ((writtenRows >> i) & 1)
+			screen[i] = state.screen[i];
+	}
+
+	loadRegisters(state);
+	writtenPages = 0;
+	writtenRows = 0;
+}
+
+void Chip8::loadRegisters(const Chip8State& state) {
+	// States built in memory skip Chip8State::load's checks, so keep pc and sp in range here too
+	pc = state.pc & 0xFFF;
+	I = state.I;
+	sp = state.sp > 16 ? 16 : state.sp;
+	memcpy(stack, state.stack, sizeof(stack));
+	memcpy(V, state.V, sizeof(V));
+	delay_timer = state.delay_timer;
+	sound_timer = state.sound_timer;
+	rngState = state.rngState;
+	seed = state.seed;
+	frames = state.frames;
 
+	drawFlag = true;
+	playBeep = false;
+}
 
+// Expands the framebuffer to one byte per pixel (0 or 1), 64 * 32 bytes
+void Chip8::unpackPixels(unsigned char * out) const {
+	for (int y = 0; y < 32; ++y) {
+		uint64_t row = screen[y];
+		for (int x = 0; x < 64; ++x)
+			*out++ = (row >> (63 - x)) & 1;
+	}
+}
 
 // Render in the console to help find bugs
 void Chip8::debugRender() {
 	// Draw
 	for (int y = 0; y < 32; ++y) {
 		for (int x = 0; x < 64; ++x) {
-			if (pixels[(y * 64) + x] == 0)
+			if (!pixel(x, y))
 				printf("O");
 			else
 				printf(" ");
@@ -722,7 +1196,6 @@ void Chip8::debugRender() {
 }
 
 bool Chip8::loadApplication(const char * filename) {
-	init();
 	printf("Loading: %s\n", filename);
 
 	// Open file
@@ -739,30 +1212,48 @@ bool Chip8::loadApplication(const char * filename) {
 	printf("Filesize: %d\n", (int)lSize);
 
 	// Allocate memory to contain whole file
-	char * buffer = (char*)malloc(sizeof(char) * lSize);
+	unsigned char * buffer = (unsigned char*)malloc(sizeof(char) * lSize);
 	if (buffer == NULL) {
 		fputs("Memory error", stderr);
+		fclose(pFile);
 		return false;
 	}
 
 	// Copy the file into the buffer
 	size_t result = fread(buffer, 1, lSize, pFile);
-	if (result != lSize) {
+	fclose(pFile);
+	if (result != (size_t)lSize) {
 		fputs("Reading error", stderr);
+		free(buffer);
 		return false;
 	}
 
 	// Copy buffer to Chip8 memory
-	if ((4096 - 512) > lSize) {
-		for (int i = 0; i < lSize; ++i)
-			memory[i + 512] = buffer[i];
-	}
-	else
+	bool loaded = loadApplication(buffer, lSize);
+	if (!loaded)
 		printf("Error: ROM too big for memory");
 
-	// Close file, free buffer
-	fclose(pFile);
 	free(buffer);
+	return loaded;
+}
+
+// Resets the machine with a ROM image at 0x200
+bool Chip8::loadApplication(const unsigned char * data, size_t size) {
+	return loadApplication(Chip8Image::create(data, size));
+}
 
+// Resets the machine to run from an image shared with other instances
+bool Chip8::loadApplication(std::shared_ptr<const Chip8Image> image) {
+	init();
+	if (!image)
+		return false;
+
+	attach(std::move(image));
 	return true;
-}
\ No newline at end of file
+}
+
+// True when the program has stopped on a jump to itself
+bool Chip8::halted() const {
+	unsigned short address = pc & 0xFFF;
+	return readOpcode(address) == (0x1000 | address);
+}
@@ -1,4 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+class Chip8;
+class Chip8BlockCache;
+class Chip8Jit;
+class Chip8Tracer;
+class Chip8Profiler;
+struct Chip8State;
+
+struct Chip8Op;
+typedef void(*Chip8Exec)(Chip8&, const Chip8Op&);
+
+// A decoded opcode: the handler to run plus its operands
+struct Chip8Op {
+	Chip8Exec exec;
+	unsigned short opcode;
+	unsigned short nnn;		// Address (lowest 12 bits)
+	unsigned char  x;		// Second nibble
+	unsigned char  y;		// Third nibble
+	unsigned char  n;		// Lowest nibble
+	unsigned char  nn;		// Lowest byte
+};
+
+// Memory as an application is loaded: fontset at 0, ROM at 0x200. Instances running the
+// same application share one read-only image and copy out only the 64 byte pages they write.
+struct Chip8Image {
+	unsigned char bytes[4096];
+
+	// NULL when the ROM doesn't fit in memory
+	static std::shared_ptr<const Chip8Image> create(const unsigned char * data, size_t size);
+};
+
+// Behaviour that differs between CHIP-8 interpreters, chosen once per instance
+enum class Chip8Quirks : unsigned char {
+	Default,		// What this emulator has always done
+	Vip,			// The original COSMAC VIP interpreter
+	Chip48,			// CHIP-48 on the HP-48
+	SuperChip		// SUPER-CHIP 1.1
+};
+
+// Where FX55/FX65 leave I
+enum class Chip8MemoryQuirk : unsigned char {
+	PastLast,		// I + X + 1
+	AtLast,			// I + X
+	Unchanged
+};
+
+// What a quirk profile does. Every profile gets its own handlers and dispatch table built
+// from these at compile time, so no handler checks a flag while running.
+struct Chip8QuirkSet {
+	bool shiftReadsVY;			// 8XY6/8XYE shift V[Y] into V[X] instead of shifting V[X] in place
+	bool logicResetsVF;			// 8XY1/8XY2/8XY3 clear V[F]
+	bool jumpUsesVX;			// BXNN jumps to XNN + V[X] instead of NNN + V[0]
+	bool addIFlagsOverflow;		// FX1E sets V[F] when I goes past 0xFFF
+	bool clipSprites;			// DXYN cuts sprites off at the screen edges instead of wrapping them
+	Chip8MemoryQuirk memory;
+
+	static constexpr Chip8QuirkSet of(Chip8Quirks quirks) {
+		switch (quirks) {
+		case Chip8Quirks::Vip:			return { true,  true,  false, false, true,  Chip8MemoryQuirk::PastLast };
+		case Chip8Quirks::Chip48:		return { false, false, true,  false, true,  Chip8MemoryQuirk::AtLast };
+		case Chip8Quirks::SuperChip:	return { false, false, true,  false, true,  Chip8MemoryQuirk::Unchanged };
+		default:						return { false, false, false, true,  false, Chip8MemoryQuirk::PastLast };
+		}
+	}
+};
+
+// How instructions are dispatched
+enum class Chip8Engine {
+	Interpreter,	// Fetch and decode every instruction
+	Cached,			// Execute pre-decoded blocks from the translation cache
+	Jit				// Cached, with hot blocks recompiled to native code (x86-64 only)
+};
+
 class Chip8 {
+	template <Chip8Quirks Quirks> friend struct Chip8OpTable;
+	friend struct Chip8KernelTable;
+	template <int Lanes> friend class Chip8Lockstep;
+	friend class Chip8BlockCache;
+	friend class Chip8Jit;
+	friend struct Chip8Instructions;
 
 public:
 	Chip8();
@@ -9,17 +93,63 @@ public:
 
 	bool drawFlag;
 	bool playBeep;
+
+	unsigned int cyclesPerFrame;	// Instructions executed per 60 Hz frame
+	bool skipIdle;					// Fast-forward idle loops to the end of the frame
+	unsigned long long idleCycles;	// Cycles fast-forwarded since the application was loaded
+	unsigned long long unknownOpcodes;	// Opcodes that didn't decode to an instruction
+	unsigned long long frames;		// Frames run since the application was loaded
+	unsigned long long presents;	// Frames presentFrame said to show
+	unsigned long long skippedPresents;	// Frames drawn to that looked the same as the last one shown
 	
-	void fetch();
-	void execute();
 	void emulateCycle();
+	void emulateCycleSwitch();
+	void runCycles(unsigned long long cycles);
+	void runFrame();
+	void endFrame();
+	void setEngine(Chip8Engine engine);
+	Chip8Engine getEngine() const;
+	void setQuirks(Chip8Quirks quirks);
+	Chip8Quirks getQuirks() const;
 	void debugRender();
 	bool loadApplication(const char * filename);
+	bool loadApplication(const unsigned char * data, size_t size);
+	bool loadApplication(std::shared_ptr<const Chip8Image> image);
+	unsigned int copiedPages() const;	// Pages of memory no longer shared with the image
+	void seedRandom(uint64_t seed);
+	uint64_t randomSeed() const { return seed; }
+	bool halted() const;
+	unsigned long long frameHash() const;
+	bool presentFrame();			// Once per frame: true when the framebuffer needs showing
+	unsigned long long memoryHash() const;
+	void saveState(Chip8State& state) const;
+	void loadState(const Chip8State& state);
+	void snapshot(Chip8State& state);
+	void resetTo(const Chip8State& state);
+
+#if CHIP8_TRACE
+	// Records every executed instruction to a binary trace file until stopTrace is called
+	bool startTrace(const char * filename);
+	// Returns how many records the writer fell too far behind to keep
+	unsigned long long stopTrace();
+#endif
 
+#if CHIP8_PROFILE
+	// Counts executed instructions per opcode class, pc and call stack until stopProfile is called
+	Chip8Profiler & startProfile();
+	const Chip8Profiler * profile() const { return profiler.get(); }
+	void stopProfile();
+#endif
 
+	static Chip8Op decode(unsigned short opcode, Chip8Quirks quirks = Chip8Quirks::Default);
+	static bool endsBlock(const Chip8Op& op);
+
+	// Unpacked view of the framebuffer
+	bool pixel(int x, int y) const { return (screen[y] >> (63 - x)) & 1; }
+	void unpackPixels(unsigned char * out) const;
 
 	// Chip8
-	unsigned char  pixels[64 * 32];	// Total amount of pixels: 2048
+	uint64_t       screen[32];		// One 64 bit word per row, bit 63 is the leftmost pixel
 	unsigned char  key[16];
 
 private:
@@ -30,58 +160,100 @@ private:
 
 	unsigned char  V[16];			// V-registers (V0-VF)
 	unsigned short stack[16];		// Stack (16 levels)
-	unsigned char  memory[4096];	// Memory (size = 4k)		
+
+	// Memory (size = 4k) as 64 byte pages, each in the shared image until the first write to it
+	const unsigned char * pages[64];
+	uint64_t       privatePages;	// One bit per page copied out of the image
+	std::shared_ptr<const Chip8Image> image;
+
+	uint64_t       presentedHash;	// frameHash of the framebuffer last presented
+
+	uint64_t       seed;			// Seed the generator was last started from
+	uint64_t       rngState;		// Per-instance random number generator
+
+	uint64_t       writtenPages;	// One bit per 64 byte page of memory written since the last snapshot
+	uint32_t       writtenRows;		// One bit per framebuffer row changed since the last snapshot
+
+	Chip8Engine engine;
+	Chip8Quirks quirks;
+	const Chip8Exec * handlers;		// Handlers for the quirk profile, indexed by the decode table
+	std::unique_ptr<Chip8BlockCache> blockCache;
+	std::unique_ptr<Chip8Jit> jit;
+#if CHIP8_TRACE
+	std::unique_ptr<Chip8Tracer> tracer;
+	void traceOp(unsigned short opcode);
+#endif
+#if CHIP8_PROFILE
+	std::unique_ptr<Chip8Profiler> profiler;
+#endif
 
 	void updateTimers();
 	void init();
+	void attach(std::shared_ptr<const Chip8Image> image);
+	void releasePages();
+	unsigned char * writablePage(unsigned int page);
+	unsigned char read(unsigned short address) const { return pages[(address >> 6) & 63][address & 63]; }
+	unsigned short readOpcode(unsigned short address) const {
+		// Both bytes are in one page unless the opcode straddles two
+		const unsigned char * page = pages[(address >> 6) & 63];
+		unsigned int offset = address & 63;
+		return offset != 63 ? page[offset] << 8 | page[offset + 1] : page[63] << 8 | read(address + 1);
+	}
+	void loadRegisters(const Chip8State& state);
+	void store(unsigned short address, unsigned char value);
+	unsigned char nextRandom();
+	bool mayIdle() const;
+	unsigned long long skipIdleLoop(unsigned long long cycles);
+
+	Chip8Op decodeOp(unsigned short opcode) const;
+	template <void (Chip8::*Handler)(const Chip8Op&)>
+	static void call(Chip8& c8, const Chip8Op& op);
+
+	void unknownOp(const Chip8Op& op);
+
+	void dispClear(const Chip8Op& op);
+	void retFromSub(const Chip8Op& op);
+	void jump(const Chip8Op& op);
+	void callSub(const Chip8Op& op);
+	void skipVXisNN(const Chip8Op& op);
+	void skipVXnotNN(const Chip8Op& op);
+	void skipVXisVY(const Chip8Op& op);
+	void setVXtoNN(const Chip8Op& op);
+	void addVXNN(const Chip8Op& op);
+
+	void setVXtoVY(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void VXorVY(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void VXandVY(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void VXxorXY(const Chip8Op& op);
+	void addVXVY(const Chip8Op& op);
+	void subVXVY(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void rightShift(const Chip8Op& op);
+	void subVYVX(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void leftShift(const Chip8Op& op);
+
+	void skipVXisntVY(const Chip8Op& op);
+	void setAddr(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void jumpV0(const Chip8Op& op);
+	void random(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void disp(const Chip8Op& op);
+	void checkKeyDown(const Chip8Op& op);
+	void checkKeyUp(const Chip8Op& op);
+	void getDelay(const Chip8Op& op);
+	void awaitKey(const Chip8Op& op);
+	void setDelay(const Chip8Op& op);
+	void setSound(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void addIVX(const Chip8Op& op);
+	void spriteAddr(const Chip8Op& op);
+	void setBCD(const Chip8Op& op);
+
+	template <Chip8Quirks Quirks> void regDump(const Chip8Op& op);
+	template <Chip8Quirks Quirks> void regLoad(const Chip8Op& op);
+
+	template <Chip8Quirks Quirks> static bool quirkEndsBlock(const Chip8Op& op);
+};
 
-	void cpuNULL();
-	void cpuRetClear();
-	void cpuARITHMETIC();
-	void cpuKEYS();
-	void cpuTimerMem1();
-	void cpuTimerMem2();
-
-	void dispClear();
-	void retFromSub();
-	void jump();
-	void callSub();
-	void skipVXisNN();
-	void skipVXnotNN();
-	void skipVXisVY();
-	void setVXtoNN();
-	void addVXNN();
-
-	void setVXtoVY();
-	void VXorVY();
-	void VXandVY();
-	void VXxorXY();
-	void addVXVY();
-	void subVXVY();
-	void rightShift();
-	void subVYVX();
-	void leftShift();
-
-	void skipVXisntVY();
-	void setAddr();
-	void jumpV0();
-	void random();
-	void disp();
-	void checkKeyDown();
-	void checkKeyUp();
-	void getDelay();
-	void awaitKey();
-	void setDelay();
-	void setSound();
-	void addIVX();
-	void spriteAddr();
-	void setBCD();
-
-	void regDump();
-	void regLoad();
-
-	void(*Chip8Table[16])();
-	void(*Chip8Arithmetic[16])();
-
-
-};
\ No newline at end of file
+// Calls a handler through a plain function pointer so table entries stay small
+template <void (Chip8::*Handler)(const Chip8Op&)>
+void Chip8::call(Chip8& c8, const Chip8Op& op) {
+	(c8.*Handler)(op);
+}
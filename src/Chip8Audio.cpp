@@ -0,0 +1,183 @@
+#include "Chip8Audio.h"
+#include <string.h>
+
+Chip8Audio::Chip8Audio(unsigned int sampleRate) : sampleRate(sampleRate), frequency(400), amplitude(8000),
+	dropped(0), sink(NULL), frames(0), tone(false), generated(0), phase(0), playing(false), hasNext(false) {
+}
+
+Chip8Audio::~Chip8Audio() {
+	stop();
+}
+
+bool Chip8Audio::start(Chip8AudioSink * sink) {
+	stop();
+	if (!sink->open(*this))
+		return false;
+	this->sink = sink;
+	return true;
+}
+
+bool Chip8Audio::stop() {
+	bool written = sink == NULL || sink->close();
+	sink = NULL;
+	return written;
+}
+
+void Chip8Audio::frame(Chip8& c8) {
+	// The timer ran out during this frame if playBeep is set, so the frame still sounds
+	frame(c8.sound_timer > 0 || c8.playBeep);
+	c8.playBeep = false;
+}
+
+// XO-CHIP's pattern and pitch aren't played, its sound timer sounds the usual tone
+void Chip8Audio::frame(Chip8Extended& c8) {
+	frame(c8.sound_timer > 0 || c8.playBeep);
+	c8.playBeep = false;
+}
+
+void Chip8Audio::frame(bool on) {
+	if (on != tone) {
+		Chip8AudioCommand command = { time(), (uint8_t)on };
+		if (commands.push(command))
+			tone = on;
+		else
+			++dropped;
+	}
+	++frames;
+
+	if (sink != NULL)
+		sink->frame();
+}
+
+void Chip8Audio::render(int16_t * out, size_t count) {
+	uint32_t step = (uint32_t)(((uint64_t)frequency << 32) / sampleRate);
+
+	while (count > 0) {
+		if (!hasNext)
+			hasNext = commands.pop(next);
+
+		// A device sink runs off its own clock. When a command turns up late, or further ahead
+		// than the device should ever lag, restart from it so tones keep their length.
+		if (hasNext && (next.time < generated || next.time > generated + sampleRate / 4))
+			generated = next.time;
+		if (hasNext && next.time == generated) {
+			playing = next.on != 0;
+			hasNext = false;
+			continue;
+		}
+
+		size_t span = count;
+		if (hasNext && next.time - generated < span)
+			span = (size_t)(next.time - generated);
+
+		if (playing) {
+			for (size_t i = 0; i < span; ++i) {
+				out[i] = (phase & 0x80000000) ? amplitude : (int16_t)-amplitude;
+				phase += step;
+			}
+		}
+		else
+			memset(out, 0, span * sizeof(int16_t));
+
+		out += span;
+		count -= span;
+		generated += span;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Chip8NullSink::open(Chip8Audio & audio) {
+	this->audio = &audio;
+	return true;
+}
+
+void Chip8NullSink::frame() {
+	int16_t samples[1024];
+	while (audio->position() < audio->time()) {
+		uint64_t count = audio->time() - audio->position();
+		audio->render(samples, count < 1024 ? (size_t)count : 1024);
+	}
+}
+
+bool Chip8NullSink::close() {
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+// Canonical 44 byte header of a PCM WAV file
+struct Chip8WavHeader {
+	char     riff[4];			// "RIFF"
+	uint32_t riffSize;
+	char     wave[4];			// "WAVE"
+	char     fmt[4];			// "fmt "
+	uint32_t fmtSize;
+	uint16_t format;			// 1 for PCM
+	uint16_t channels;
+	uint32_t sampleRate;
+	uint32_t byteRate;
+	uint16_t blockAlign;
+	uint16_t bitsPerSample;
+	char     data[4];			// "data"
+	uint32_t dataSize;
+};
+static_assert(sizeof(Chip8WavHeader) == 44, "WAV header must be 44 bytes");
+
+Chip8WavSink::Chip8WavSink(const char * filename) : filename(filename), file(NULL), audio(NULL), samples(0), failed(false) {
+}
+
+Chip8WavSink::~Chip8WavSink() {
+	close();
+}
+
+bool Chip8WavSink::open(Chip8Audio & audio) {
+	close();
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+	this->audio = &audio;
+	samples = 0;
+	failed = false;
+
+	// Sizes are filled in by close()
+	Chip8WavHeader header = {};
+	return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+void Chip8WavSink::frame() {
+	int16_t buffer[1024];
+	while (audio->position() < audio->time()) {
+		uint64_t count = audio->time() - audio->position();
+		size_t n = count < 1024 ? (size_t)count : 1024;
+		audio->render(buffer, n);
+		if (fwrite(buffer, sizeof(int16_t), n, file) != n)
+			failed = true;
+		samples += (uint32_t)n;
+	}
+}
+
+bool Chip8WavSink::close() {
+	if (file == NULL)
+		return true;
+
+	Chip8WavHeader header;
+	memcpy(header.riff, "RIFF", 4);
+	header.riffSize = 36 + samples * 2;
+	memcpy(header.wave, "WAVE", 4);
+	memcpy(header.fmt, "fmt ", 4);
+	header.fmtSize = 16;
+	header.format = 1;
+	header.channels = 1;
+	header.sampleRate = audio->sampleRate;
+	header.byteRate = audio->sampleRate * 2;
+	header.blockAlign = 2;
+	header.bitsPerSample = 16;
+	memcpy(header.data, "data", 4);
+	header.dataSize = samples * 2;
+
+	bool written = !failed && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	written = fclose(file) == 0 && written;
+	file = NULL;
+	return written;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "Chip8.h"
+#include "Chip8Extended.h"
+#include "Chip8Queue.h"
+
+// The tone switching on or off, from a sample on the emulation's audio clock
+struct Chip8AudioCommand {
+	uint64_t time;
+	uint8_t  on;
+};
+
+class Chip8Audio;
+
+// Where the generated samples go. Device sinks pull from the generator on their own thread as
+// the hardware needs samples. File sinks are pulled from the emulation thread after every frame
+// instead, so their output follows emulated time exactly however fast the emulation runs.
+class Chip8AudioSink {
+
+public:
+	virtual ~Chip8AudioSink() {}
+
+	virtual bool open(Chip8Audio & audio) = 0;
+	virtual void frame() {}			// Called from the emulation thread after every frame
+	virtual bool close() = 0;		// False if some of the output couldn't be written
+};
+
+// Square wave generator for the sound timer. The emulation side queues a command whenever the
+// tone starts or stops, stamped with the sample it belongs at, and the sink pulls samples that
+// follow the commands to the sample. The tone lasts exactly as many frames as the sound timer.
+class Chip8Audio {
+
+public:
+	Chip8Audio(unsigned int sampleRate = 44100);
+	~Chip8Audio();
+
+	bool start(Chip8AudioSink * sink);
+	bool stop();					// False if the sink couldn't write all of its output
+
+	// Emulation side: call after every frame, consumes playBeep
+	void frame(Chip8& c8);
+	void frame(Chip8Extended& c8);
+	uint64_t time() const { return frames * sampleRate / 60; }	// Sample the next frame starts at
+
+	// Sink side: fills count mono samples
+	void render(int16_t * out, size_t count);
+	uint64_t position() const { return generated; }
+
+	unsigned int sampleRate;
+	unsigned int frequency;		// Tone pitch in Hz
+	int16_t amplitude;
+
+	unsigned long long dropped;	// Commands lost to a full queue because no sink was pulling
+
+private:
+	Chip8AudioSink * sink;
+	Chip8SpscQueue<Chip8AudioCommand, 256> commands;
+
+	// Emulation side
+	uint64_t frames;
+	bool tone;
+
+	void frame(bool on);
+
+	// Sink side
+	uint64_t generated;
+	uint32_t phase;
+	bool playing;
+	bool hasNext;
+	Chip8AudioCommand next;
+};
+
+// Generates and throws the samples away, for timing runs without an output
+class Chip8NullSink : public Chip8AudioSink {
+
+public:
+	bool open(Chip8Audio & audio);
+	void frame();
+	bool close();
+
+private:
+	Chip8Audio * audio;
+};
+
+// Writes 16 bit mono PCM to a WAV file
+class Chip8WavSink : public Chip8AudioSink {
+
+public:
+	Chip8WavSink(const char * filename);
+	~Chip8WavSink();
+
+	bool open(Chip8Audio & audio);
+	void frame();
+	bool close();
+
+private:
+	const char * filename;
+	FILE * file;
+	Chip8Audio * audio;
+	uint32_t samples;
+	bool failed;					// A sample write failed, reported by close()
+};
+
+// The desktop's audio device: waveOut on Windows, ALSA on Linux when it was found at build time.
+// open() fails when there is neither, and the emulator runs silent.
+class Chip8SystemSink : public Chip8AudioSink {
+
+public:
+	Chip8SystemSink();
+	~Chip8SystemSink();
+
+	bool open(Chip8Audio & audio);
+	bool close();
+
+private:
+	struct Device;
+	Device * device;
+};
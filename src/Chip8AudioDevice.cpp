@@ -0,0 +1,142 @@
+#include "Chip8Audio.h"
+#include <atomic>
+#include <thread>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#elif CHIP8_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+// Samples per buffer handed to the device, about 12 ms at 44.1 kHz
+static const size_t bufferSamples = 512;
+
+// An audio thread that keeps the device fed from the generator
+struct Chip8SystemSink::Device {
+	Chip8Audio * audio;
+	std::thread thread;
+	std::atomic<bool> running;
+
+#ifdef _WIN32
+	static const int bufferCount = 4;
+	HWAVEOUT handle;
+	HANDLE done;				// Signalled by waveOut whenever a buffer has played
+	WAVEHDR headers[bufferCount];
+	int16_t buffers[bufferCount][bufferSamples];
+
+	void run() {
+		while (running.load(std::memory_order_relaxed)) {
+			for (int i = 0; i < bufferCount; ++i) {
+				if ((headers[i].dwFlags & WHDR_DONE) == 0)
+					continue;
+				audio->render(buffers[i], bufferSamples);
+				waveOutWrite(handle, &headers[i], sizeof(WAVEHDR));
+			}
+			WaitForSingleObject(done, 50);
+		}
+	}
+#elif CHIP8_ALSA
+	snd_pcm_t * pcm;
+	int16_t buffer[bufferSamples];
+
+	void run() {
+		while (running.load(std::memory_order_relaxed)) {
+			audio->render(buffer, bufferSamples);
+			snd_pcm_sframes_t written = snd_pcm_writei(pcm, buffer, bufferSamples);
+			if (written < 0)
+				snd_pcm_recover(pcm, (int)written, 1);
+		}
+	}
+#endif
+};
+
+Chip8SystemSink::Chip8SystemSink() : device(NULL) {
+}
+
+Chip8SystemSink::~Chip8SystemSink() {
+	close();
+}
+
+bool Chip8SystemSink::open(Chip8Audio & audio) {
+	close();
+
+#ifdef _WIN32
+	device = new Device();
+	device->audio = &audio;
+
+	WAVEFORMATEX format = {};
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = 1;
+	format.nSamplesPerSec = audio.sampleRate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = 2;
+	format.nAvgBytesPerSec = audio.sampleRate * 2;
+
+	device->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (waveOutOpen(&device->handle, WAVE_MAPPER, &format, (DWORD_PTR)device->done, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+		CloseHandle(device->done);
+		delete device;
+		device = NULL;
+		return false;
+	}
+
+	// Prepared buffers start out marked done so the thread fills every one of them first
+	for (int i = 0; i < Device::bufferCount; ++i) {
+		WAVEHDR & header = device->headers[i];
+		memset(&header, 0, sizeof(header));
+		header.lpData = (LPSTR)device->buffers[i];
+		header.dwBufferLength = sizeof(device->buffers[i]);
+		waveOutPrepareHeader(device->handle, &header, sizeof(WAVEHDR));
+		header.dwFlags |= WHDR_DONE;
+	}
+#elif CHIP8_ALSA
+	device = new Device();
+	device->audio = &audio;
+
+	if (snd_pcm_open(&device->pcm, "default", SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+		delete device;
+		device = NULL;
+		return false;
+	}
+	// 50 ms of device latency, resampled by ALSA if the hardware wants another rate
+	if (snd_pcm_set_params(device->pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 1, audio.sampleRate, 1, 50000) < 0) {
+		snd_pcm_close(device->pcm);
+		delete device;
+		device = NULL;
+		return false;
+	}
+#else
+	(void)audio;
+	return false;
+#endif
+
+#if defined(_WIN32) || CHIP8_ALSA
+	device->running = true;
+	device->thread = std::thread(&Device::run, device);
+	return true;
+#endif
+}
+
+bool Chip8SystemSink::close() {
+	if (device == NULL)
+		return true;
+
+	device->running = false;
+	device->thread.join();
+
+#ifdef _WIN32
+	waveOutReset(device->handle);
+	for (int i = 0; i < Device::bufferCount; ++i)
+		waveOutUnprepareHeader(device->handle, &device->headers[i], sizeof(WAVEHDR));
+	waveOutClose(device->handle);
+	CloseHandle(device->done);
+#elif CHIP8_ALSA
+	snd_pcm_drop(device->pcm);
+	snd_pcm_close(device->pcm);
+#endif
+
+	delete device;
+	device = NULL;
+	return true;
+}
@@ -0,0 +1,158 @@
+#include "Chip8Batch.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// A worker's queue of instance indices. The owner takes from the front, thieves from the back.
+struct Chip8BatchQueue {
+	std::mutex lock;
+	std::deque<size_t> items;
+
+	bool take(size_t& item, bool steal) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.empty())
+			return false;
+		if (steal) {
+			item = items.back();
+			items.pop_back();
+		}
+		else {
+			item = items.front();
+			items.pop_front();
+		}
+		return true;
+	}
+
+	void put(size_t item) {
+		std::lock_guard<std::mutex> guard(lock);
+		items.push_back(item);
+	}
+};
+
+Chip8Batch::Chip8Batch(unsigned int threads) : seconds(0), totalCycles(0), totalFrames(0), totalCopiedPages(0), threads(threads) {
+	if (this->threads == 0)
+		this->threads = std::thread::hardware_concurrency();
+	if (this->threads == 0)
+		this->threads = 1;
+}
+
+size_t Chip8Batch::add(const Chip8BatchJob& job) {
+	queued.push_back(job);
+	return queued.size() - 1;
+}
+
+std::shared_ptr<const Chip8Image> Chip8Batch::readRom(const std::string& path) {
+	auto found = roms.find(path);
+	if (found != roms.end())
+		return found->second;
+
+	std::shared_ptr<const Chip8Image> & image = roms[path];
+	FILE * pFile = fopen(path.c_str(), "rb");
+	if (pFile == NULL)
+		return NULL;
+
+	std::vector<unsigned char> data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(pFile);
+
+	if (!data.empty())
+		image = Chip8Image::create(data.data(), data.size());
+	return image;
+}
+
+void Chip8Batch::run() {
+	size_t count = queued.size();
+	finished.assign(count, Chip8BatchResult());
+
+	// Set every instance up on this thread; ROMs shared between jobs are read once
+	std::vector<std::unique_ptr<Chip8> > instances(count);
+	std::vector<std::unique_ptr<Chip8BatchQueue> > queues;
+	for (unsigned int t = 0; t < threads; ++t)
+		queues.emplace_back(new Chip8BatchQueue());
+
+	std::atomic<size_t> remaining(0);
+	for (size_t i = 0; i < count; ++i) {
+		const Chip8BatchJob & job = queued[i];
+		std::shared_ptr<const Chip8Image> rom = readRom(job.rom);
+		instances[i].reset(new Chip8());
+		Chip8 & c8 = *instances[i];
+		c8.setEngine(job.engine);
+		c8.setQuirks(job.quirks);
+		c8.cyclesPerFrame = job.cyclesPerFrame;
+		c8.skipIdle = job.skipIdle;
+
+		finished[i].loaded = rom != NULL && c8.loadApplication(rom);
+		if (!finished[i].loaded)
+			continue;
+		c8.seedRandom(job.seed);
+
+		queues[i % threads]->put(i);
+		++remaining;
+	}
+
+	auto worker = [&](unsigned int self) {
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			size_t i;
+			bool found = queues[self]->take(i, false);
+			for (unsigned int t = 1; !found && t < threads; ++t)
+				found = queues[(self + t) % threads]->take(i, true);
+			if (!found) {
+				// Everything left is being run by another worker right now
+				std::this_thread::yield();
+				continue;
+			}
+
+			const Chip8BatchJob & job = queued[i];
+			Chip8BatchResult & result = finished[i];
+			Chip8 & c8 = *instances[i];
+
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned int f = 0; f < sliceFrames && result.frames < job.frames; ++f) {
+				c8.runFrame();
+				++result.frames;
+				if (job.stopWhenHalted && c8.halted()) {
+					result.halted = true;
+					break;
+				}
+			}
+			result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			if (result.halted || result.frames >= job.frames) {
+				result.cycles = result.frames * job.cyclesPerFrame;
+				result.idleCycles = c8.idleCycles;
+				result.unknownOpcodes = c8.unknownOpcodes;
+				result.frameHash = c8.frameHash();
+				result.copiedPages = c8.copiedPages();
+				instances[i].reset();
+				remaining.fetch_sub(1, std::memory_order_release);
+			}
+			else
+				queues[self]->put(i);
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (unsigned int t = 1; t < threads; ++t)
+		pool.emplace_back(worker, t);
+	worker(0);
+	for (auto & t : pool)
+		t.join();
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	totalCycles = 0;
+	totalFrames = 0;
+	totalCopiedPages = 0;
+	for (const Chip8BatchResult & result : finished) {
+		totalCycles += result.cycles;
+		totalFrames += result.frames;
+		totalCopiedPages += result.copiedPages;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+// One instance to run in a batch
+struct Chip8BatchJob {
+	std::string rom;
+	unsigned long long frames;		// Frames to run, or the most to run when stopWhenHalted is set
+	bool stopWhenHalted;			// Finish early once the program jumps to itself
+	uint64_t seed;
+	Chip8Engine engine;
+	Chip8Quirks quirks;
+	unsigned int cyclesPerFrame;
+	bool skipIdle;					// Fast-forward idle loops
+};
+
+struct Chip8BatchResult {
+	bool loaded;
+	bool halted;
+	unsigned long long frames;
+	unsigned long long cycles;
+	unsigned long long idleCycles;
+	unsigned long long unknownOpcodes;
+	unsigned long long frameHash;
+	unsigned int copiedPages;		// 64 byte pages of memory the instance no longer shares with the image
+	double seconds;					// Time spent running this instance, summed over all slices
+};
+
+// Runs many independent Chip8 instances on a work-stealing thread pool. Instances are
+// split into slices of frames; each worker runs slices from its own queue and steals
+// from the others when it runs dry, so long and short jobs even out across threads.
+class Chip8Batch {
+
+public:
+	explicit Chip8Batch(unsigned int threads = 0);	// 0 uses every hardware thread
+
+	static const unsigned int sliceFrames = 60;
+
+	size_t add(const Chip8BatchJob& job);
+	void run();
+
+	unsigned int threadCount() const { return threads; }
+	const std::vector<Chip8BatchJob> & jobs() const { return queued; }
+	const std::vector<Chip8BatchResult> & results() const { return finished; }
+
+	// Totals over every instance from the last run
+	double seconds;					// Wall clock time of the whole batch
+	unsigned long long totalCycles;
+	unsigned long long totalFrames;
+	unsigned long long totalCopiedPages;
+
+private:
+	unsigned int threads;
+	std::vector<Chip8BatchJob> queued;
+	std::vector<Chip8BatchResult> finished;
+	std::map<std::string, std::shared_ptr<const Chip8Image> > roms;	// Each ROM file is read once and its image shared
+
+	std::shared_ptr<const Chip8Image> readRom(const std::string& path);
+};
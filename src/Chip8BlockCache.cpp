@@ -0,0 +1,75 @@
+#include "Chip8BlockCache.h"
+#include <string.h>
+
+// Flush everything once the arena holds this many ops, reclaiming space left by invalidated blocks
+static const size_t arenaLimit = 0x10000;
+
+Chip8BlockCache::Chip8BlockCache() {
+	flush();
+	arena.reserve(1024);
+}
+
+void Chip8BlockCache::flush() {
+	memset(index, 0, sizeof(index));
+	codePages = 0;
+	blocks.clear();
+	freeSlots.clear();
+	arena.clear();
+}
+
+// Decode instructions from pc until one that can branch, wait or write to memory
+Chip8Block & Chip8BlockCache::translate(const Chip8& c8, unsigned short pc) {
+	pc &= 0xFFF;
+	if (arena.size() + maxBlockLength > arenaLimit)
+		flush();
+
+	Chip8Block block;
+	block.start = pc;
+	block.length = 0;
+	block.first = (unsigned int)arena.size();
+	block.hits = 0;
+	block.native = NULL;
+
+	unsigned short address = pc;
+	do {
+		const Chip8Op op = c8.decodeOp(c8.readOpcode(address));
+		arena.push_back(op);
+		++block.length;
+		address += 2;
+		if (Chip8::endsBlock(op))
+			break;
+	} while (block.length < maxBlockLength && address < 0xFFF);
+
+	// Remember which pages hold code so writes elsewhere skip the invalidation scan
+	for (unsigned short page = pc >> 6; page <= ((address - 1) & 0xFFF) >> 6; ++page)
+		codePages |= 1ULL << page;
+
+	unsigned short slot;
+	if (!freeSlots.empty()) {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+		blocks[slot] = block;
+	}
+	else {
+		slot = (unsigned short)blocks.size();
+		blocks.push_back(block);
+	}
+	index[pc] = slot + 1;
+
+	return blocks[slot];
+}
+
+// Drop every block whose instructions cover address
+void Chip8BlockCache::invalidateBlocks(unsigned short address) {
+	int lowest = address - (maxBlockLength * 2 - 1);
+	if (lowest < 0)
+		lowest = 0;
+
+	for (int start = lowest; start <= address; ++start) {
+		unsigned short slot = index[start];
+		if (slot != 0 && start + blocks[slot - 1].length * 2 > address) {
+			index[start] = 0;
+			freeSlots.push_back(slot - 1);
+		}
+	}
+}
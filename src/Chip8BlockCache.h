@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include "Chip8.h"
+
+// A straight-line run of pre-decoded instructions. Only the last op can branch,
+// skip, wait or write to memory, so the ops can be executed back-to-back.
+struct Chip8Block {
+	unsigned short start;		// Address of the first instruction
+	unsigned short length;		// Number of instructions
+	unsigned int   first;		// Index of the first instruction in the op arena
+	unsigned int   hits;		// Times the block was interpreted, used to pick blocks to compile
+	void(*native)(Chip8*);		// Compiled code for the whole block, NULL until compiled
+};
+
+// Translation cache of pre-decoded blocks, indexed by the address they start at
+class Chip8BlockCache {
+
+public:
+	Chip8BlockCache();
+
+	static const int maxBlockLength = 32;
+
+	// Returns the block starting at pc, decoding it from memory if it isn't cached
+	Chip8Block & fetch(const Chip8& c8, unsigned short pc) {
+		unsigned short slot = index[pc & 0xFFF];
+		return slot != 0 ? blocks[slot - 1] : translate(c8, pc);
+	}
+
+	const Chip8Op * ops(const Chip8Block& block) const { return &arena[block.first]; }
+
+	// Called when memory is written, drops every block containing the address
+	void invalidate(unsigned short address) {
+		if ((codePages >> ((address & 0xFFF) >> 6)) & 1)
+			invalidateBlocks(address & 0xFFF);
+	}
+
+	void flush();
+
+private:
+	unsigned short index[4096];			// Block slot + 1 for each start address, 0 when not cached
+	unsigned long long codePages;		// One bit per 64 byte page that holds cached code
+	std::vector<Chip8Block> blocks;
+	std::vector<unsigned short> freeSlots;
+	std::vector<Chip8Op> arena;			// Decoded ops of every block
+
+	Chip8Block & translate(const Chip8& c8, unsigned short pc);
+	void invalidateBlocks(unsigned short address);
+};
@@ -0,0 +1,113 @@
+#include "Chip8Capture.h"
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+Chip8Capture::Chip8Capture() : frames(0), repeats(0), stalls(0), running(false), file(NULL),
+	format(Chip8CaptureFormat::Raw), scale(1), failed(false) {
+	current.frames = 0;
+}
+
+Chip8Capture::~Chip8Capture() {
+	stop();
+}
+
+bool Chip8Capture::start(const char * filename, Chip8CaptureFormat format, int scale) {
+	stop();
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+
+	this->format = format;
+	this->scale = scale > 0 ? scale : 1;
+	if (format == Chip8CaptureFormat::Y4M)
+		fprintf(file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", 64 * this->scale, 32 * this->scale);
+
+	frames = 0;
+	repeats = 0;
+	stalls = 0;
+	current.frames = 0;
+	failed = false;
+	running = true;
+	writer = std::thread(&Chip8Capture::drain, this);
+	return true;
+}
+
+bool Chip8Capture::stop() {
+	if (!running)
+		return !failed;
+
+	flush();
+	running = false;
+	writer.join();
+	if (fclose(file) != 0)
+		failed = true;
+	file = NULL;
+	return !failed;
+}
+
+void Chip8Capture::frame(const Chip8& c8) {
+	if (!running.load(std::memory_order_relaxed))
+		return;
+
+	++frames;
+	if (current.frames > 0 && memcmp(current.screen, c8.screen, sizeof(current.screen)) == 0) {
+		++current.frames;
+		++repeats;
+		return;
+	}
+
+	flush();
+	memcpy(current.screen, c8.screen, sizeof(current.screen));
+	current.frames = 1;
+}
+
+// Queues the current run, waiting for the writer if it's a full queue behind
+void Chip8Capture::flush() {
+	if (current.frames == 0)
+		return;
+
+	if (!queue.push(current)) {
+		++stalls;
+		while (!queue.push(current))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	current.frames = 0;
+}
+
+void Chip8Capture::drain() {
+	const int width = 64 * scale;
+	const int height = 32 * scale;
+	const unsigned char on = format == Chip8CaptureFormat::Y4M ? 235 : 255;	// Y4M luma is studio range
+	const unsigned char off = format == Chip8CaptureFormat::Y4M ? 16 : 0;
+	std::vector<unsigned char> pixels(width * height);
+	Chip8CaptureRun run;
+
+	for (;;) {
+		bool stopping = !running.load(std::memory_order_acquire);
+		if (!queue.pop(run)) {
+			if (stopping)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		// Convert once per run, each row scaled horizontally and then repeated
+		for (int y = 0; y < 32; ++y) {
+			unsigned char * row = &pixels[y * scale * width];
+			for (int x = 0; x < 64; ++x)
+				memset(row + x * scale, (run.screen[y] >> (63 - x)) & 1 ? on : off, scale);
+			for (int i = 1; i < scale; ++i)
+				memcpy(row + i * width, row, width);
+		}
+
+		// Neither format can say "same again", so repeats rewrite the converted frame
+		for (uint32_t i = 0; i < run.frames; ++i) {
+			if (format == Chip8CaptureFormat::Y4M)
+				fputs("FRAME\n", file);
+			if (fwrite(pixels.data(), 1, pixels.size(), file) != pixels.size())
+				failed = true;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "Chip8.h"
+#include "Chip8Queue.h"
+
+enum class Chip8CaptureFormat {
+	Raw,		// 8 bit greyscale pixels, frame after frame, for ffmpeg -f rawvideo -pix_fmt gray
+	Y4M			// YUV4MPEG2 with a monochrome luma plane at 60 fps
+};
+
+// A framebuffer and how many frames in a row it stayed on screen
+struct Chip8CaptureRun {
+	uint64_t screen[32];
+	uint32_t frames;
+};
+
+// Video capture of the framebuffer at every 60 Hz frame. The emulator thread only compares
+// the packed framebuffer against the last one and queues it when it changed; unchanged frames
+// just count as repeats of the queued one. A background thread scales, converts and writes.
+// The queue holds a few seconds of distinct frames, and the emulator only waits when the
+// writer is that far behind, which the stall counter records.
+class Chip8Capture {
+
+public:
+	Chip8Capture();
+	~Chip8Capture();
+
+	bool start(const char * filename, Chip8CaptureFormat format, int scale = 1);
+	bool stop();					// Writes out everything queued, false if a write failed
+
+	void frame(const Chip8& c8);	// Call after every frame
+
+	unsigned long long frames;		// Frames captured
+	unsigned long long repeats;		// Of those, unchanged from the frame before
+	unsigned long long stalls;		// Times the emulator waited on a full queue
+
+private:
+	Chip8SpscQueue<Chip8CaptureRun, 256> queue;
+	Chip8CaptureRun current;		// Run being extended by the emulator thread, not queued yet
+	std::atomic<bool> running;
+	std::thread writer;
+	FILE * file;
+	Chip8CaptureFormat format;
+	int scale;
+	bool failed;
+
+	void flush();
+	void drain();
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// One bit plane of a Width x Height framebuffer, each row packed into 64 bit words with bit 63
+// of the first word as the leftmost pixel. Everything works a word at a time: drawing shifts a
+// sprite row across at most two words, and scrolling moves whole rows or shifts words across
+// their neighbours. Instantiated at the resolution in use, so 64 pixel rows are a single word.
+template <int Width, int Height>
+struct Chip8Plane {
+	static_assert(Width % 64 == 0, "Rows must be whole words");
+	static const int words = Width / 64;
+
+	uint64_t rows[Height][words];
+
+	void clear() {
+		memset(rows, 0, sizeof(rows));
+	}
+
+	// XORs a sprite row onto row y at x. bits holds the sprite pixels at the top of the word.
+	// Pixels past the right edge wrap to the left unless clip is set. Returns true on collision.
+	bool drawRow(int x, int y, uint64_t bits, bool clip) {
+		int word = x / 64;
+		int offset = x % 64;
+		uint64_t * row = rows[y];
+
+		uint64_t first = bits >> offset;
+		uint64_t second = offset != 0 ? bits << (64 - offset) : 0;
+		uint64_t collision = row[word] & first;
+		row[word] ^= first;
+		if (second != 0 && (word + 1 < words || !clip)) {
+			uint64_t & next = row[(word + 1) % words];
+			collision |= next & second;
+			next ^= second;
+		}
+		return collision != 0;
+	}
+
+	// 00CN: Moves everything down n rows, the top n rows come in empty
+	void scrollDown(int n) {
+		if (n >= Height) {
+			clear();
+			return;
+		}
+		memmove(rows[n], rows[0], sizeof(rows[0]) * (Height - n));
+		memset(rows[0], 0, sizeof(rows[0]) * n);
+	}
+
+	// 00DN: Moves everything up n rows, the bottom n rows come in empty
+	void scrollUp(int n) {
+		if (n >= Height) {
+			clear();
+			return;
+		}
+		memmove(rows[0], rows[n], sizeof(rows[0]) * (Height - n));
+		memset(rows[Height - n], 0, sizeof(rows[0]) * n);
+	}
+
+	// 00FB: Moves everything right 4 pixels, carrying bits from each word into the next
+	void scrollRight() {
+		for (int y = 0; y < Height; ++y) {
+			for (int i = words - 1; i > 0; --i)
+				rows[y][i] = rows[y][i] >> 4 | rows[y][i - 1] << 60;
+			rows[y][0] >>= 4;
+		}
+	}
+
+	// 00FC: Moves everything left 4 pixels
+	void scrollLeft() {
+		for (int y = 0; y < Height; ++y) {
+			for (int i = 0; i < words - 1; ++i)
+				rows[y][i] = rows[y][i] << 4 | rows[y][i + 1] >> 60;
+			rows[y][words - 1] <<= 4;
+		}
+	}
+
+	bool pixel(int x, int y) const { return (rows[y][x / 64] >> (63 - x % 64)) & 1; }
+};
+
+// XO-CHIP's two bit planes, giving four colours. Drawing, clearing and scrolling only touch
+// the planes selected with FN01; plain CHIP-8 and SUPER-CHIP programs only ever select plane 0.
+template <int Width, int Height>
+struct Chip8Display {
+	static const int width = Width;
+	static const int height = Height;
+
+	Chip8Plane<Width, Height> planes[2];
+
+	void clear(unsigned char mask) {
+		for (int p = 0; p < 2; ++p) {
+			if ((mask >> p) & 1)
+				planes[p].clear();
+		}
+	}
+
+	// Colour of a pixel, plane 0 in bit 0 and plane 1 in bit 1
+	unsigned char pixel(int x, int y) const {
+		return (unsigned char)(planes[0].pixel(x, y) | planes[1].pixel(x, y) << 1);
+	}
+};
@@ -0,0 +1,421 @@
+#include "Chip8Extended.h"
+#include "Chip8Instructions.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+extern unsigned char chip8_fontset[80];
+
+// SUPER-CHIP's 8x10 digits, with XO-CHIP's A to F after them
+static const unsigned char bigFontset[160] =
+{
+	0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+	0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+	0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+	0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+	0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+	0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+	0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+	0x3C, 0x7E, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+	0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// Where the big font starts, straight after the small one
+static const unsigned short bigFontAddress = 80;
+
+Chip8Extended::Chip8Extended(Chip8ExtendedMode mode) : mode(mode), cyclesPerFrame(30) {
+	init();
+	seedRandom(1);
+}
+
+void Chip8Extended::init() {
+	pc = 0x200;
+	I = 0;
+	sp = 0;
+	memset(V, 0, sizeof(V));
+	memset(stack, 0, sizeof(stack));
+	memset(key, 0, sizeof(key));
+	memset(pattern, 0, sizeof(pattern));
+	pitch = 64;
+
+	memset(memory, 0, sizeof(memory));
+	memcpy(memory, chip8_fontset, sizeof(chip8_fontset));
+	memcpy(memory + bigFontAddress, bigFontset, sizeof(bigFontset));
+	memoryMask = mode == Chip8ExtendedMode::XoChip ? 0xFFFF : 0xFFF;
+
+	low.clear(3);
+	high.clear(3);
+	highRes = false;
+	planeMask = 1;
+	exited = false;
+
+	delay_timer = 0;
+	sound_timer = 0;
+	drawFlag = true;
+	playBeep = false;
+
+	unknownOpcodes = 0;
+	frames = 0;
+	presents = 0;
+	skippedPresents = 0;
+	presentedHash = ~frameHash();
+}
+
+// Same generator as Chip8, so a seed gives the same sequence on either machine
+void Chip8Extended::seedRandom(uint64_t seed) {
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	rngState = (z ^ (z >> 31)) | 1;
+}
+
+unsigned char Chip8Extended::nextRandom() {
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return (unsigned char)((rngState * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+bool Chip8Extended::loadApplication(const char * filename) {
+	printf("Loading: %s\n", filename);
+	FILE * file = fopen(filename, "rb");
+	if (file == NULL) {
+		fputs("File error", stderr);
+		return false;
+	}
+
+	// Read one byte more than fits so an oversized ROM is caught
+	std::vector<unsigned char> buffer(65536 - 512 + 1);
+	size_t size = fread(buffer.data(), 1, buffer.size(), file);
+	fclose(file);
+
+	bool loaded = loadApplication(buffer.data(), size);
+	if (!loaded)
+		printf("Error: ROM too big for memory");
+	return loaded;
+}
+
+bool Chip8Extended::loadApplication(const unsigned char * data, size_t size) {
+	init();
+	if (size > memoryMask + 1 - 512)
+		return false;
+	memcpy(memory + 512, data, size);
+	return true;
+}
+
+void Chip8Extended::runCycles(unsigned long long cycles) {
+	// Each loop runs until the program switches resolution, then the other one takes over
+	while (cycles > 0 && !exited) {
+		if (mode == Chip8ExtendedMode::XoChip)
+			cycles -= highRes ? run<Chip8ExtendedMode::XoChip>(high, cycles) : run<Chip8ExtendedMode::XoChip>(low, cycles);
+		else
+			cycles -= highRes ? run<Chip8ExtendedMode::SuperChip>(high, cycles) : run<Chip8ExtendedMode::SuperChip>(low, cycles);
+	}
+}
+
+void Chip8Extended::runFrame() {
+	runCycles(cyclesPerFrame);
+	endFrame();
+}
+
+void Chip8Extended::endFrame() {
+	if (delay_timer > 0)
+		--delay_timer;
+	if (sound_timer > 0) {
+		if (sound_timer == 1)
+			playBeep = true;
+		--sound_timer;
+	}
+	++frames;
+}
+
+// Runs up to cycles instructions at one resolution, returns how many ran. Stops straight
+// after an instruction that switches resolution or exits. The classic instructions run the
+// same bodies as Chip8's handlers, only the display and extended ones are here.
+template <Chip8ExtendedMode Mode, class Display>
+unsigned long long Chip8Extended::run(Display& display, unsigned long long cycles) {
+	// SUPER-CHIP behaves like the CHIP-48 it grew out of. XO-CHIP follows the VIP apart from
+	// V[F] after logic ops, and wraps sprites around the edges.
+	constexpr Chip8QuirkSet quirks = Mode == Chip8ExtendedMode::SuperChip ? Chip8QuirkSet::of(Chip8Quirks::SuperChip)
+		: Chip8QuirkSet{ true, false, false, false, false, Chip8MemoryQuirk::PastLast };
+
+	for (unsigned long long done = 1; done <= cycles; ++done) {
+		unsigned short opcode = read(pc) << 8 | read(pc + 1);
+		const Chip8Op op = { NULL, opcode, (unsigned short)(opcode & 0x0FFF), (unsigned char)((opcode & 0x0F00) >> 8),
+			(unsigned char)((opcode & 0x00F0) >> 4), (unsigned char)(opcode & 0x000F), (unsigned char)(opcode & 0x00FF) };
+
+		// Skips step over XO-CHIP's four byte F000 NNNN in one go
+		unsigned short skip = 4;
+		if (Mode == Chip8ExtendedMode::XoChip && read(pc + 2) == 0xF0 && read(pc + 3) == 0x00)
+			skip = 6;
+
+		switch (opcode & 0xF000) {
+		case 0x0000:
+			if ((opcode & 0xFFF0) == 0x00C0) {			// 00CN: Scroll down N rows
+				for (int p = 0; p < 2; ++p) {
+					if ((planeMask >> p) & 1)
+						display.planes[p].scrollDown(op.n);
+				}
+				drawFlag = true;
+				pc += 2;
+			}
+			else if (Mode == Chip8ExtendedMode::XoChip && (opcode & 0xFFF0) == 0x00D0) {	// 00DN: Scroll up N rows
+				for (int p = 0; p < 2; ++p) {
+					if ((planeMask >> p) & 1)
+						display.planes[p].scrollUp(op.n);
+				}
+				drawFlag = true;
+				pc += 2;
+			}
+			else {
+				switch (opcode) {
+				case 0x00E0: // 00E0: Clears the selected planes
+					display.clear(planeMask);
+					drawFlag = true;
+					pc += 2;
+					break;
+				case 0x00EE:
+					Chip8Instructions::retFromSub(*this);
+					break;
+				case 0x00FB: // 00FB: Scroll right 4 pixels
+				case 0x00FC: // 00FC: Scroll left 4 pixels
+					for (int p = 0; p < 2; ++p) {
+						if ((planeMask >> p) & 1) {
+							if (opcode == 0x00FB)
+								display.planes[p].scrollRight();
+							else
+								display.planes[p].scrollLeft();
+						}
+					}
+					drawFlag = true;
+					pc += 2;
+					break;
+				case 0x00FD: // 00FD: Exit the interpreter
+					exited = true;
+					return done;
+				case 0x00FE: // 00FE: 64x32 low resolution
+				case 0x00FF: // 00FF: 128x64 high resolution
+					pc += 2;
+					if (highRes != (opcode == 0x00FF)) {
+						// The other resolution's framebuffer starts out clear, and takes over from here
+						highRes = opcode == 0x00FF;
+						if (highRes)
+							high.clear(3);
+						else
+							low.clear(3);
+						drawFlag = true;
+						return done;
+					}
+					break;
+				default:
+					Chip8Instructions::unknownOp(*this);
+				}
+			}
+			break;
+
+		case 0x1000: Chip8Instructions::jump(*this, op); break;
+		case 0x2000: Chip8Instructions::callSub(*this, op); break;
+		case 0x3000: Chip8Instructions::skipVXisNN(*this, op, skip); break;
+		case 0x4000: Chip8Instructions::skipVXnotNN(*this, op, skip); break;
+
+		case 0x5000:
+			if (op.n == 0)
+				Chip8Instructions::skipVXisVY(*this, op, skip);
+			else if (Mode == Chip8ExtendedMode::XoChip && (op.n == 2 || op.n == 3)) {
+				// 5XY2: Stores V[X] to V[Y] at I, 5XY3: Loads them, in either order. I doesn't change
+				int step = op.x <= op.y ? 1 : -1;
+				for (int i = 0, r = op.x; ; ++i, r += step) {
+					if (op.n == 2)
+						store(I + i, V[r]);
+					else
+						V[r] = read(I + i);
+					if (r == op.y)
+						break;
+				}
+				pc += 2;
+			}
+			else
+				Chip8Instructions::unknownOp(*this);
+			break;
+
+		case 0x6000: Chip8Instructions::setVXtoNN(*this, op); break;
+		case 0x7000: Chip8Instructions::addVXNN(*this, op); break;
+
+		case 0x8000:
+			switch (op.n) {
+			case 0x0: Chip8Instructions::setVXtoVY(*this, op); break;
+			case 0x1: Chip8Instructions::VXorVY<quirks.logicResetsVF>(*this, op); break;
+			case 0x2: Chip8Instructions::VXandVY<quirks.logicResetsVF>(*this, op); break;
+			case 0x3: Chip8Instructions::VXxorXY<quirks.logicResetsVF>(*this, op); break;
+			case 0x4: Chip8Instructions::addVXVY(*this, op); break;
+			case 0x5: Chip8Instructions::subVXVY(*this, op); break;
+			case 0x6: Chip8Instructions::rightShift<quirks.shiftReadsVY>(*this, op); break;
+			case 0x7: Chip8Instructions::subVYVX(*this, op); break;
+			case 0xE: Chip8Instructions::leftShift<quirks.shiftReadsVY>(*this, op); break;
+			default: Chip8Instructions::unknownOp(*this);
+			}
+			break;
+
+		case 0x9000: Chip8Instructions::skipVXisntVY(*this, op, skip); break;
+		case 0xA000: Chip8Instructions::setAddr(*this, op); break;
+		case 0xB000: Chip8Instructions::jumpV0<quirks.jumpUsesVX>(*this, op); break;
+		case 0xC000: Chip8Instructions::random(*this, op); break;
+
+		case 0xD000: // DXYN: Draws an 8xN sprite, or 16x16 when N is 0
+			draw<Mode>(display, op);
+			break;
+
+		case 0xE000:
+			if (op.nn == 0x9E)
+				Chip8Instructions::checkKeyDown(*this, op, skip);
+			else if (op.nn == 0xA1)
+				Chip8Instructions::checkKeyUp(*this, op, skip);
+			else
+				Chip8Instructions::unknownOp(*this);
+			break;
+
+		case 0xF000:
+			if (Mode == Chip8ExtendedMode::XoChip && opcode == 0xF000) {	// F000 NNNN: Sets I to the 16 bit address NNNN
+				I = read(pc + 2) << 8 | read(pc + 3);
+				pc += 4;
+				break;
+			}
+			if (Mode == Chip8ExtendedMode::XoChip && op.nn == 0x01) {	// FN01: Selects the planes to draw on
+				planeMask = op.x & 3;
+				pc += 2;
+				break;
+			}
+			if (Mode == Chip8ExtendedMode::XoChip && opcode == 0xF002) {	// F002: Loads the audio pattern from I
+				for (int i = 0; i < 16; ++i)
+					pattern[i] = read(I + i);
+				pc += 2;
+				break;
+			}
+
+			switch (op.nn) {
+			case 0x07: Chip8Instructions::getDelay(*this, op); break;
+			case 0x0A: Chip8Instructions::awaitKey(*this, op); break;
+			case 0x15: Chip8Instructions::setDelay(*this, op); break;
+			case 0x18: Chip8Instructions::setSound(*this, op); break;
+			case 0x1E: Chip8Instructions::addIVX<quirks.addIFlagsOverflow>(*this, op); break;
+			case 0x29: Chip8Instructions::spriteAddr(*this, op); break;
+			case 0x30: // FX30: Points I at the big font character in V[X]
+				I = bigFontAddress + (V[op.x] & 0xF) * 10;
+				pc += 2;
+				break;
+			case 0x33: Chip8Instructions::setBCD(*this, op); break;
+			case 0x3A: // FX3A: Sets the audio pattern's pitch to V[X]
+				if (Mode == Chip8ExtendedMode::XoChip) {
+					pitch = V[op.x];
+					pc += 2;
+				}
+				else
+					Chip8Instructions::unknownOp(*this);
+				break;
+			case 0x55: Chip8Instructions::regDump<quirks.memory>(*this, op); break;
+			case 0x65: Chip8Instructions::regLoad<quirks.memory>(*this, op); break;
+			case 0x75: // FX75: Saves V[0] to V[X] in the RPL flags, 8 of them on SUPER-CHIP
+				for (int i = 0; i <= (Mode == Chip8ExtendedMode::XoChip ? op.x : op.x & 7); ++i)
+					flags[i] = V[i];
+				pc += 2;
+				break;
+			case 0x85: // FX85: Loads V[0] to V[X] from the RPL flags
+				for (int i = 0; i <= (Mode == Chip8ExtendedMode::XoChip ? op.x : op.x & 7); ++i)
+					V[i] = flags[i];
+				pc += 2;
+				break;
+			default:
+				Chip8Instructions::unknownOp(*this);
+			}
+			break;
+		}
+	}
+	return cycles;
+}
+
+// DXYN: XORs a sprite from I onto each selected plane, the second plane's data following
+// the first's. N rows of 8 pixels, or 16 rows of 16 pixels for DXY0. V[F] is set on collision.
+template <Chip8ExtendedMode Mode, class Display>
+void Chip8Extended::draw(Display& display, const Chip8Op& op) {
+	const bool clip = Mode == Chip8ExtendedMode::SuperChip;
+	const int rows = op.n == 0 ? 16 : op.n;
+	const int rowBytes = op.n == 0 ? 2 : 1;
+
+	// The starting position wraps around the screen in either mode
+	int x = V[op.x] & (Display::width - 1);
+	int y = V[op.y] & (Display::height - 1);
+
+	bool collision = false;
+	unsigned int address = I;
+	for (int p = 0; p < 2; ++p) {
+		if (((planeMask >> p) & 1) == 0)
+			continue;
+
+		for (int r = 0; r < rows; ++r) {
+			int line = y + r;
+			if (line >= Display::height) {
+				if (clip)
+					break;
+				line -= Display::height;
+			}
+
+			unsigned int at = address + r * rowBytes;
+			uint64_t bits = rowBytes == 2 ? (uint64_t)(read(at) << 8 | read(at + 1)) << 48 : (uint64_t)read(at) << 56;
+			collision |= display.planes[p].drawRow(x, line, bits, clip);
+		}
+		address += rows * rowBytes;
+	}
+
+	V[0xF] = collision;
+	drawFlag = true;
+	pc += 2;
+}
+
+// FNV-1a over the selected resolution's planes
+unsigned long long Chip8Extended::frameHash() const {
+	unsigned long long hash = 0xcbf29ce484222325ULL ^ (highRes ? 1 : 0);
+	hash *= 0x100000001b3ULL;
+	for (int p = 0; p < 2; ++p) {
+		for (int y = 0; y < height(); ++y) {
+			const uint64_t * words = row(p, y);
+			for (int i = 0; i < width() / 64; ++i) {
+				hash ^= words[i];
+				hash *= 0x100000001b3ULL;
+			}
+		}
+	}
+	return hash;
+}
+
+// Same as Chip8::presentFrame: once per frame, and only when the pixels changed
+bool Chip8Extended::presentFrame() {
+	if (!drawFlag)
+		return false;
+	drawFlag = false;
+
+	unsigned long long hash = frameHash();
+	if (hash == presentedHash) {
+		++skippedPresents;
+		return false;
+	}
+	presentedHash = hash;
+	++presents;
+	return true;
+}
+
+void Chip8Extended::debugRender() {
+	static const char shades[4] = { 'O', ' ', '+', '#' };
+	for (int y = 0; y < height(); ++y) {
+		for (int x = 0; x < width(); ++x)
+			putchar(shades[pixel(x, y)]);
+		putchar('\n');
+	}
+	putchar('\n');
+}
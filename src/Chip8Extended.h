@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Chip8.h"
+#include "Chip8Display.h"
+
+// Which extension set a Chip8Extended runs
+enum class Chip8ExtendedMode : unsigned char {
+	SuperChip,		// SUPER-CHIP 1.1: 128x64, 16x16 sprites, scrolling, big font, RPL flags
+	XoChip			// XO-CHIP: SUPER-CHIP plus 64K memory, two bit planes, scroll up and audio patterns
+};
+
+// A SUPER-CHIP or XO-CHIP machine. It is kept apart from Chip8 so the classic 64x32, 4K core
+// and its engines stay exactly as fast as they are. There is a framebuffer per resolution,
+// each a Chip8Display instantiated for its size, and the interpreter loop is compiled once
+// per resolution and mode. 00FE/00FF switch loops in between instructions, so no drawing or
+// scrolling code checks the resolution.
+class Chip8Extended {
+	friend struct Chip8Instructions;
+
+public:
+	Chip8Extended(Chip8ExtendedMode mode = Chip8ExtendedMode::SuperChip);
+
+	Chip8ExtendedMode mode;
+
+	unsigned char  delay_timer;
+	unsigned char  sound_timer;
+	unsigned char  key[16];
+
+	bool drawFlag;
+	bool playBeep;
+
+	unsigned char  pattern[16];		// XO-CHIP audio pattern, one bit per sample
+	unsigned char  pitch;			// XO-CHIP playback rate, 4000 * 2^((pitch - 64) / 48) Hz
+
+	unsigned int cyclesPerFrame;
+	unsigned long long unknownOpcodes;
+	unsigned long long frames;
+	unsigned long long presents;
+	unsigned long long skippedPresents;
+
+	bool loadApplication(const char * filename);
+	bool loadApplication(const unsigned char * data, size_t size);
+	void seedRandom(uint64_t seed);
+
+	void runCycles(unsigned long long cycles);
+	void runFrame();
+	void endFrame();
+
+	bool halted() const { return exited; }	// 00FD was executed
+	bool hires() const { return highRes; }
+	int width() const { return highRes ? 128 : 64; }
+	int height() const { return highRes ? 64 : 32; }
+
+	// Colour (0 to 3) at a pixel of the current resolution
+	unsigned char pixel(int x, int y) const { return highRes ? high.pixel(x, y) : low.pixel(x, y); }
+	// Words of a row of one plane at the current resolution, width() / 64 of them
+	const uint64_t * row(int plane, int y) const { return highRes ? high.planes[plane].rows[y] : low.planes[plane].rows[y]; }
+
+	unsigned long long frameHash() const;
+	bool presentFrame();
+	void debugRender();
+
+private:
+	unsigned short pc;
+	unsigned short I;
+	unsigned short sp;
+	unsigned char  V[16];
+	unsigned short stack[16];
+	unsigned char  flags[16];		// RPL user flags, FX75/FX85
+
+	unsigned char  memory[65536];
+	unsigned int   memoryMask;		// 0xFFF for SUPER-CHIP, 0xFFFF for XO-CHIP
+
+	Chip8Display<64, 32>  low;
+	Chip8Display<128, 64> high;
+	bool highRes;
+	unsigned char planeMask;		// Planes selected with FN01
+	bool exited;
+
+	uint64_t rngState;
+	uint64_t presentedHash;
+
+	void init();
+	unsigned char nextRandom();
+	unsigned char read(unsigned int address) const { return memory[address & memoryMask]; }
+	void store(unsigned int address, unsigned char value) { memory[address & memoryMask] = value; }
+
+	template <Chip8ExtendedMode Mode, class Display>
+	unsigned long long run(Display& display, unsigned long long cycles);
+	template <Chip8ExtendedMode Mode, class Display>
+	void draw(Display& display, const Chip8Op& op);
+};
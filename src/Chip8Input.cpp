@@ -0,0 +1,203 @@
+#include "Chip8Input.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+static uint16_t keyMask(const Chip8& c8) {
+	uint16_t keys = 0;
+	for (int i = 0; i < 16; ++i) {
+		if (c8.key[i] != 0)
+			keys |= 1 << i;
+	}
+	return keys;
+}
+
+Chip8InputLog::Chip8InputLog() : next(0), lastKeys(0) {
+	memset(&header, 0, sizeof(header));
+}
+
+bool Chip8InputLog::start(const Chip8& c8) {
+	// The log starts from the loaded state, so it can't pick up a session already under way
+	if (c8.frames != 0)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "C8IN", 4);
+	header.version = 1;
+	header.cyclesPerFrame = (uint16_t)c8.cyclesPerFrame;
+	header.quirks = (uint8_t)c8.getQuirks();
+	header.seed = c8.randomSeed();
+	header.memoryHash = c8.memoryHash();
+
+	events.clear();
+	lastKeys = 0;
+	return true;
+}
+
+void Chip8InputLog::record(const Chip8& c8) {
+	uint16_t keys = keyMask(c8);
+	if (keys == lastKeys)
+		return;
+
+	Chip8InputEvent event = { (uint32_t)c8.frames, keys, 0 };
+	events.push_back(event);
+	lastKeys = keys;
+}
+
+void Chip8InputLog::finish(const Chip8& c8) {
+	header.frames = c8.frames;
+	header.frameHash = c8.frameHash();
+	header.events = (uint32_t)events.size();
+}
+
+bool Chip8InputLog::save(const char * filename) const {
+	FILE * file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(events.data(), sizeof(Chip8InputEvent), events.size(), file) == events.size();
+	return fclose(file) == 0 && written;
+}
+
+bool Chip8InputLog::load(const char * filename) {
+	FILE * file = fopen(filename, "rb");
+	if (file == NULL)
+		return false;
+
+	events.clear();
+	bool loaded = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "C8IN", 4) == 0 && header.version == 1;
+	if (loaded) {
+		events.resize(header.events);
+		loaded = fread(events.data(), sizeof(Chip8InputEvent), events.size(), file) == events.size();
+	}
+	fclose(file);
+	return loaded;
+}
+
+// Puts c8 back in the state the recording started from
+bool Chip8InputLog::begin(Chip8& c8) {
+	if (c8.frames != 0 || c8.memoryHash() != header.memoryHash)
+		return false;
+
+	c8.cyclesPerFrame = header.cyclesPerFrame;
+	c8.setQuirks((Chip8Quirks)header.quirks);
+	c8.seedRandom(header.seed);
+	for (int i = 0; i < 16; ++i)
+		c8.key[i] = 0;
+	next = 0;
+	return true;
+}
+
+void Chip8InputLog::apply(Chip8& c8) {
+	for (; next < events.size() && events[next].frame <= c8.frames; ++next) {
+		for (int i = 0; i < 16; ++i)
+			c8.key[i] = (events[next].keys >> i) & 1;
+	}
+}
+
+bool Chip8InputLog::replay(Chip8& c8) {
+	if (!begin(c8))
+		return false;
+
+	while (c8.frames < header.frames) {
+		apply(c8);
+		c8.runFrame();
+	}
+	return c8.frameHash() == header.frameHash;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+Chip8Keymap::Chip8Keymap() {
+	clear();
+
+	static const char layout[] = "1234" "qwer" "asdf" "zxcv";
+	static const unsigned char keypad[] = {
+		0x1, 0x2, 0x3, 0xC,
+		0x4, 0x5, 0x6, 0xD,
+		0x7, 0x8, 0x9, 0xE,
+		0xA, 0x0, 0xB, 0xF
+	};
+	for (int i = 0; i < 16; ++i) {
+		unsigned char host = layout[i];
+		map(host, keypad[i]);
+		// Shift can change between a key going down and coming back up
+		if (host >= 'a' && host <= 'z')
+			map(host - 'a' + 'A', keypad[i]);
+	}
+}
+
+void Chip8Keymap::clear() {
+	memset(keys, 0xFF, sizeof(keys));
+}
+
+Chip8InputQueue::Chip8InputQueue() : events(0), totalLatency(0), maxLatency(0), hasPending(false) {
+
+}
+
+uint64_t Chip8InputQueue::now() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool Chip8InputQueue::next(Chip8KeyEvent& event) {
+	if (!hasPending && !queue.pop(pending))
+		return false;
+	hasPending = true;
+	event = pending;
+	return true;
+}
+
+void Chip8InputQueue::apply(unsigned char * keys, const Chip8KeyEvent& event) {
+	hasPending = false;
+	unsigned char key = keymap.keys[event.hostKey];
+	if (key == 0xFF)
+		return;
+	keys[key] = event.down;
+
+	uint64_t latency = now() - event.time;
+	++events;
+	totalLatency += latency;
+	if (latency > maxLatency)
+		maxLatency = latency;
+}
+
+template <class Machine>
+void Chip8InputQueue::run(Machine& c8, uint64_t frameStart, uint64_t frameLength) {
+	unsigned int done = 0;
+	Chip8KeyEvent event;
+	while (next(event) && event.time < frameStart + frameLength) {
+		// Instruction the event lines up with
+		unsigned int at = event.time <= frameStart ? 0
+			: (unsigned int)((event.time - frameStart) * c8.cyclesPerFrame / frameLength);
+		if (at > done) {
+			c8.runCycles(at - done);
+			done = at;
+		}
+		apply(c8.key, event);
+	}
+
+	c8.runCycles(c8.cyclesPerFrame - done);
+	c8.endFrame();
+}
+
+void Chip8InputQueue::runFrame(Chip8& c8, uint64_t frameStart, uint64_t frameLength) {
+	run(c8, frameStart, frameLength);
+}
+
+void Chip8InputQueue::runFrame(Chip8Extended& c8, uint64_t frameStart, uint64_t frameLength) {
+	run(c8, frameStart, frameLength);
+}
+
+void Chip8InputQueue::applyAll(Chip8& c8) {
+	Chip8KeyEvent event;
+	while (next(event))
+		apply(c8.key, event);
+}
+
+void Chip8InputQueue::applyAll(Chip8Extended& c8) {
+	Chip8KeyEvent event;
+	while (next(event))
+		apply(c8.key, event);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Chip8.h"
+#include "Chip8Extended.h"
+#include "Chip8Queue.h"
+
+// Key state at the start of a frame, one bit per key, logged whenever it changes
+struct Chip8InputEvent {
+	uint32_t frame;
+	uint16_t keys;
+	uint16_t reserved;
+};
+
+// Header at the start of an input log, followed by packed Chip8InputEvents
+struct Chip8InputHeader {
+	char     magic[4];			// "C8IN"
+	uint16_t version;
+	uint16_t cyclesPerFrame;
+	uint64_t seed;				// Random seed the session started with
+	uint64_t memoryHash;		// Memory right after the application was loaded
+	uint64_t frames;			// Length of the session
+	uint64_t frameHash;			// Framebuffer at the end of the session
+	uint32_t events;
+	uint8_t  quirks;			// Chip8Quirks the session ran with
+	uint8_t  reserved[3];
+};
+
+// Records a session's key presses against frame numbers so it can be replayed exactly,
+// headless and as fast as the machine allows. Keys only change in between frames, and the
+// random generator is seeded per instance, so the seed and the key log fully determine a run.
+class Chip8InputLog {
+
+public:
+	Chip8InputLog();
+
+	// Recording: start right after loading, record before every runFrame, finish at the end
+	bool start(const Chip8& c8);
+	void record(const Chip8& c8);
+	void finish(const Chip8& c8);
+	bool save(const char * filename) const;
+
+	// Replaying: c8 must have the same application freshly loaded
+	bool load(const char * filename);
+	bool begin(Chip8& c8);
+	void apply(Chip8& c8);			// Sets the keys for the frame about to run
+	bool replay(Chip8& c8);			// Runs the whole session, true if it ends on the recorded frame
+
+	const Chip8InputHeader & info() const { return header; }
+
+private:
+	Chip8InputHeader header;
+	std::vector<Chip8InputEvent> events;
+	size_t next;
+	uint16_t lastKeys;
+};
+
+// A host key going down or up, stamped when the front end saw it
+struct Chip8KeyEvent {
+	uint64_t time;				// Chip8InputQueue::now() clock, in nanoseconds
+	uint8_t  hostKey;
+	uint8_t  down;
+};
+
+// Host key code to CHIP-8 key, 0xFF where nothing is mapped
+struct Chip8Keymap {
+	unsigned char keys[256];
+
+	Chip8Keymap();				// 1234/QWER/ASDF/ZXCV onto the hex keypad, either case
+	void clear();
+	void map(unsigned char hostKey, unsigned char chip8Key) { keys[hostKey] = chip8Key & 0xF; }
+};
+
+// Key events from a front end thread to the emulator. The front end pushes events as they
+// happen and never touches Chip8::key; the emulator applies them between instructions, each at
+// the instruction matching its time within the frame, so input lands at the same point of the
+// emulated frame however the host threads are scheduled.
+class Chip8InputQueue {
+
+public:
+	Chip8InputQueue();
+
+	static uint64_t now();
+
+	// Front end side, false when the queue is full and the event was dropped
+	bool push(unsigned char hostKey, bool down) {
+		Chip8KeyEvent event = { now(), hostKey, (uint8_t)down };
+		return queue.push(event);
+	}
+
+	// Emulator side. runFrame runs one frame covering [frameStart, frameStart + frameLength),
+	// applying events stamped inside it at the matching instruction, earlier ones before the
+	// first and leaving later ones for the next frame. applyAll applies everything queued.
+	// Chip8Extended machines take their input the same way.
+	void runFrame(Chip8& c8, uint64_t frameStart, uint64_t frameLength);
+	void runFrame(Chip8Extended& c8, uint64_t frameStart, uint64_t frameLength);
+	void applyAll(Chip8& c8);
+	void applyAll(Chip8Extended& c8);
+
+	Chip8Keymap keymap;
+
+	// Time from an event being pushed to it reaching Chip8::key
+	unsigned long long events;
+	uint64_t totalLatency;
+	uint64_t maxLatency;
+
+private:
+	Chip8SpscQueue<Chip8KeyEvent, 256> queue;
+	Chip8KeyEvent pending;		// Popped but due in a later frame
+	bool hasPending;
+
+	bool next(Chip8KeyEvent& event);
+	void apply(unsigned char * keys, const Chip8KeyEvent& event);
+
+	template <class Machine>
+	void run(Machine& c8, uint64_t frameStart, uint64_t frameLength);
+};
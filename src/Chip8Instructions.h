@@ -0,0 +1,298 @@
+#pragma once
+
+#include "Chip8.h"
+
+// Bodies of the classic CHIP-8 instructions, shared by Chip8's handlers and Chip8Extended's
+// interpreter loop so each one is written once. Machine has pc, I, sp, V, stack, key, the
+// timers, unknownOpcodes, read, store and nextRandom. Quirks are template arguments, so they
+// fold away at compile time. Skips take how far a taken skip moves pc, since XO-CHIP steps
+// over its four byte F000 NNNN in one go.
+struct Chip8Instructions {
+
+	// Called for any opcode that doesn't decode to an instruction
+	template <class Machine>
+	static void unknownOp(Machine& c8) {
+		++c8.unknownOpcodes;
+	}
+
+	// 0x00EE: Returns from subroutine
+	template <class Machine>
+	static void retFromSub(Machine& c8) {
+		--c8.sp;					// 16 levels of stack, decrease stack pointer to prevent overwrite
+		c8.pc = c8.stack[c8.sp & 15];	// Put the stored return address from the stack back into the program counter
+		c8.pc += 2;
+	}
+
+	// 0x1NNN: Jumps to address NNN
+	template <class Machine>
+	static void jump(Machine& c8, const Chip8Op& op) {
+		c8.pc = op.nnn;
+	}
+
+	// 0x2NNN: Calls subroutine at NNN
+	template <class Machine>
+	static void callSub(Machine& c8, const Chip8Op& op) {
+		c8.stack[c8.sp & 15] = c8.pc;	// Store current address in stack
+		++c8.sp;					// Increment stack pointer
+		c8.pc = op.nnn;				// Set the program counter to address NNN
+	}
+
+	// 0x3XNN: Skips the next instruction if V[X] equals NN
+	template <class Machine>
+	static void skipVXisNN(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.V[op.x] == op.nn ? skip : 2;
+	}
+
+	// 0x4XNN: Skips the next instruction if V[X] doesn't equal NN
+	template <class Machine>
+	static void skipVXnotNN(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.V[op.x] != op.nn ? skip : 2;
+	}
+
+	// 0x5XY0: Skips the next instruction if V[X] equals V[Y]
+	template <class Machine>
+	static void skipVXisVY(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.V[op.x] == c8.V[op.y] ? skip : 2;
+	}
+
+	// 0x6XNN: Sets V[X] to NN
+	template <class Machine>
+	static void setVXtoNN(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] = op.nn;
+		c8.pc += 2;
+	}
+
+	// 0x7XNN: Adds NN to VX
+	template <class Machine>
+	static void addVXNN(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] += op.nn;
+		c8.pc += 2;
+	}
+
+	// 0x8XY0: Sets V[X] to the value of V[Y]
+	template <class Machine>
+	static void setVXtoVY(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] = c8.V[op.y];
+		c8.pc += 2;
+	}
+
+	// 0x8XY1: Sets V[X] to V[X] or V[Y]. The VIP clears V[F] as a side effect
+	template <bool LogicResetsVF, class Machine>
+	static void VXorVY(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] |= c8.V[op.y];
+		if constexpr (LogicResetsVF)
+			c8.V[0xF] = 0;
+		c8.pc += 2;
+	}
+
+	// 0x8XY2: Sets V[X] to V[X] and V[Y]. The VIP clears V[F] as a side effect
+	template <bool LogicResetsVF, class Machine>
+	static void VXandVY(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] &= c8.V[op.y];
+		if constexpr (LogicResetsVF)
+			c8.V[0xF] = 0;
+		c8.pc += 2;
+	}
+
+	// 0x8XY3: Sets V[X] to V[X] xor V[Y]. The VIP clears V[F] as a side effect
+	template <bool LogicResetsVF, class Machine>
+	static void VXxorXY(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] ^= c8.V[op.y];
+		if constexpr (LogicResetsVF)
+			c8.V[0xF] = 0;
+		c8.pc += 2;
+	}
+
+	// 0x8XY4: Adds V[Y] to V[X]. V[F] is set to 1 when there's a carry and to 0 when there isn't
+	template <class Machine>
+	static void addVXVY(Machine& c8, const Chip8Op& op) {
+		if (c8.V[op.y] > (0xFF - c8.V[op.x]))	// Check for carry
+			c8.V[0xF] = 1;		// Set that there is a carry
+		else
+			c8.V[0xF] = 0;		// Set that there isn't a carry
+		c8.V[op.x] += c8.V[op.y];	// V[X] = V[X] + V[Y]
+		c8.pc += 2;
+	}
+
+	// 0x8XY5: V[Y] is subtracted from V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
+	template <class Machine>
+	static void subVXVY(Machine& c8, const Chip8Op& op) {
+		if (c8.V[op.y] > c8.V[op.x])	// Check for borrow
+			c8.V[0xF] = 0;		// Set that there is a borrow
+		else
+			c8.V[0xF] = 1;		// Set that there isn't a borrow
+		c8.V[op.x] -= c8.V[op.y];	// V[X] = V[X] - V[Y]
+		c8.pc += 2;
+	}
+
+	// 0x8XY6: Shifts V[X] right by one. V[F] is set to the value of the least significant bit of V[X] before the shift.
+	// The VIP shifts V[Y] into V[X] instead
+	template <bool ShiftReadsVY, class Machine>
+	static void rightShift(Machine& c8, const Chip8Op& op) {
+		if constexpr (ShiftReadsVY)
+			c8.V[op.x] = c8.V[op.y];
+		c8.V[0xF] = c8.V[op.x] & 0x1;	// Set the LSB
+		c8.V[op.x] >>= 1;
+		c8.pc += 2;
+	}
+
+	// 0x8XY7: Sets V[X] to V[Y] minus V[X]. V[F] is set to 0 when there's a borrow and 1 when there isn't
+	template <class Machine>
+	static void subVYVX(Machine& c8, const Chip8Op& op) {
+		if (c8.V[op.x] > c8.V[op.y])	// Check for borrow
+			c8.V[0xF] = 0;		// Set that there is a borrow
+		else
+			c8.V[0xF] = 1;		// Set that there ins't a borrow
+		c8.V[op.x] = c8.V[op.y] - c8.V[op.x];	// V[X] = V[Y] - V[X]
+		c8.pc += 2;
+	}
+
+	// 0x8XYE: Shifts V[X] left by one. V[F] is set to the value of the most significant bit before shift.
+	// The VIP shifts V[Y] into V[X] instead
+	template <bool ShiftReadsVY, class Machine>
+	static void leftShift(Machine& c8, const Chip8Op& op) {
+		if constexpr (ShiftReadsVY)
+			c8.V[op.x] = c8.V[op.y];
+		c8.V[0xF] = c8.V[op.x] >> 7;	// Set V[F] to MSB
+		c8.V[op.x] <<= 1;
+		c8.pc += 2;
+	}
+
+	// 0x9XY0: Skips the next instruction if V[X] doesn't equal V[Y]
+	template <class Machine>
+	static void skipVXisntVY(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.V[op.x] != c8.V[op.y] ? skip : 2;
+	}
+
+	// ANNN: Sets I to the address of NNN
+	template <class Machine>
+	static void setAddr(Machine& c8, const Chip8Op& op) {
+		c8.I = op.nnn;
+		c8.pc += 2;
+	}
+
+	// BNNN: Jumps to the address NNN plus V[0]. CHIP-48 and SUPER-CHIP read it as BXNN, XNN plus V[X]
+	template <bool JumpUsesVX, class Machine>
+	static void jumpV0(Machine& c8, const Chip8Op& op) {
+		if constexpr (JumpUsesVX)
+			c8.pc = op.nnn + c8.V[op.x];
+		else
+			c8.pc = op.nnn + c8.V[0];
+	}
+
+	// CXNN: Sets V[X] to a random number and NN
+	template <class Machine>
+	static void random(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] = c8.nextRandom() & op.nn;
+		c8.pc += 2;
+	}
+
+	// EX9E: Skips the next instruction if the key stored in V[X] is pressed
+	template <class Machine>
+	static void checkKeyDown(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.key[c8.V[op.x] & 0xF] != 0 ? skip : 2;
+	}
+
+	// EXA1: Skips the next instruction if the key stored in V[X] isn't pressed
+	template <class Machine>
+	static void checkKeyUp(Machine& c8, const Chip8Op& op, unsigned short skip = 4) {
+		c8.pc += c8.key[c8.V[op.x] & 0xF] == 0 ? skip : 2;
+	}
+
+	// FX07: Sets V[X] to the value of the delay timer
+	template <class Machine>
+	static void getDelay(Machine& c8, const Chip8Op& op) {
+		c8.V[op.x] = c8.delay_timer;
+		c8.pc += 2;
+	}
+
+	// FX0A: A key press is awaited, and then stored in V[X]
+	template <class Machine>
+	static void awaitKey(Machine& c8, const Chip8Op& op) {
+		bool keyPress = false;
+		for (int i = 0; i < 16; ++i) {
+			if (c8.key[i] != 0) {
+				c8.V[op.x] = i;
+				keyPress = true;
+			}
+		}
+
+		// If we didn't get a keypress skip this cycle and try again
+		if (!keyPress)
+			return;
+
+		c8.pc += 2;
+	}
+
+	// FX15: Sets the delay timer to V[X]
+	template <class Machine>
+	static void setDelay(Machine& c8, const Chip8Op& op) {
+		c8.delay_timer = c8.V[op.x];
+		c8.pc += 2;
+	}
+
+	// FX18: Sets the sound timer to V[X]
+	template <class Machine>
+	static void setSound(Machine& c8, const Chip8Op& op) {
+		c8.sound_timer = c8.V[op.x];
+		c8.pc += 2;
+	}
+
+	// FX1E: Adds V[X] to I
+	template <bool AddIFlagsOverflow, class Machine>
+	static void addIVX(Machine& c8, const Chip8Op& op) {
+		if constexpr (AddIFlagsOverflow) {
+			if (c8.I + c8.V[op.x] > 0xFFF)	// V[F] is set to 1 when range overflow and 0 when it isn't
+				c8.V[0xF] = 1;
+			else
+				c8.V[0xF] = 0;
+		}
+		c8.I += c8.V[op.x];
+		c8.pc += 2;
+	}
+
+	// FX29: Sets I to the location of the sprite for the character in V[X]. Characters 0-F (in hexadecimal) are represented by a 4x5 font
+	template <class Machine>
+	static void spriteAddr(Machine& c8, const Chip8Op& op) {
+		c8.I = c8.V[op.x] * 0x5;
+		c8.pc += 2;
+	}
+
+	// FX33: Stores the binary coded decimal representation of V[X] at the address I, I+1 and I+2
+	template <class Machine>
+	static void setBCD(Machine& c8, const Chip8Op& op) {
+		c8.store(c8.I, c8.V[op.x] / 100);
+		c8.store(c8.I + 1, (c8.V[op.x] / 10) % 10);
+		c8.store(c8.I + 2, (c8.V[op.x] % 100) % 10);
+		c8.pc += 2;
+	}
+
+	// FX55: Stores V[0] to V[X] in memory starting at address I
+	template <Chip8MemoryQuirk Memory, class Machine>
+	static void regDump(Machine& c8, const Chip8Op& op) {
+		for (int i = 0; i <= op.x; ++i)
+			c8.store(c8.I + i, c8.V[i]);
+
+		// On the original interpreter, when the operation is done, I = I + X + 1. CHIP-48 stops
+		// one short of that, and SUPER-CHIP leaves I alone
+		if constexpr (Memory == Chip8MemoryQuirk::PastLast)
+			c8.I += op.x + 1;
+		else if constexpr (Memory == Chip8MemoryQuirk::AtLast)
+			c8.I += op.x;
+		c8.pc += 2;
+	}
+
+	// FX65: Fills V[0] to V[X] with value from memory starting at address I
+	template <Chip8MemoryQuirk Memory, class Machine>
+	static void regLoad(Machine& c8, const Chip8Op& op) {
+		for (int i = 0; i <= op.x; ++i)
+			c8.V[i] = c8.read(c8.I + i);
+
+		// I moves on the same way as for FX55
+		if constexpr (Memory == Chip8MemoryQuirk::PastLast)
+			c8.I += op.x + 1;
+		else if constexpr (Memory == Chip8MemoryQuirk::AtLast)
+			c8.I += op.x;
+		c8.pc += 2;
+	}
+};
@@ -0,0 +1,305 @@
+#include "Chip8Jit.h"
+#include "Chip8BlockCache.h"
+#include <string.h>
+
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+static const size_t bufferSize = 1 << 20;
+
+Chip8Jit::Chip8Jit() : buffer(NULL), size(0), used(0), out(NULL) {
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+	void * mem = VirtualAlloc(NULL, bufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void * mem = mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		mem = NULL;
+#endif
+	if (mem != NULL) {
+		buffer = (unsigned char*)mem;
+		size = bufferSize;
+		protect(false);
+	}
+#endif
+}
+
+Chip8Jit::~Chip8Jit() {
+#if CHIP8_JIT_AVAILABLE
+	if (buffer != NULL) {
+#ifdef _WIN32
+		VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+		munmap(buffer, size);
+#endif
+	}
+#endif
+}
+
+// Code is only writable while a block is being emitted
+void Chip8Jit::protect(bool writable) {
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+	DWORD old;
+	VirtualProtect(buffer, size, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+#else
+	mprotect(buffer, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+#endif
+}
+
+void Chip8Jit::reset() {
+	used = 0;
+}
+
+void Chip8Jit::emit16(unsigned short v) {
+	memcpy(out, &v, 2);
+	out += 2;
+}
+
+void Chip8Jit::emit32(unsigned int v) {
+	memcpy(out, &v, 4);
+	out += 4;
+}
+
+void Chip8Jit::emit64(unsigned long long v) {
+	memcpy(out, &v, 8);
+	out += 8;
+}
+
+// <op> with a [rbx + offset] memory operand, reg is the ModRM reg field
+void Chip8Jit::emitMem(unsigned char op, unsigned char reg, int offset) {
+	emit(op);
+	emit(0x83 | (reg << 3));	// mod = 10 (disp32), rm = rbx
+	emit32((unsigned int)offset);
+}
+
+void Chip8Jit::emitCall(const void * function) {
+	emit(0x48); emit(0xB8); emit64((unsigned long long)function);	// mov rax, function
+	emit(0xFF); emit(0xD0);											// call rax
+}
+
+// The VIP clears V[F] after 8XY1, 8XY2 and 8XY3
+void Chip8Jit::emitLogicFlag(int vf) {
+	if (quirks.logicResetsVF) {
+		emitMem(0xC6, 0, vf); emit(0);		// mov byte [vf], 0
+	}
+}
+
+// The VIP shifts V[Y] into V[X], which is V[X] = V[Y] followed by the in-place shift
+void Chip8Jit::emitShiftSource(int vx, int vy) {
+	if (quirks.shiftReadsVY) {
+		emitMem(0x8A, 0, vy);				// mov al, [vy]
+		emitMem(0x88, 0, vx);				// mov [vx], al
+	}
+}
+
+// Emits inline code for op, returns false if it has to go through the interpreter's handler.
+// Flags are computed before the result is written, in the same order as the handlers,
+// so VF is correct even when X or Y is F.
+bool Chip8Jit::emitNative(const Chip8Op& op) {
+	const int vx = offV + op.x;
+	const int vy = offV + op.y;
+	const int vf = offV + 0xF;
+
+	enum { AL = 0, CL = 1, DL = 2 };
+
+	switch (op.opcode & 0xF000) {
+	case 0x6000: // 6XNN: V[X] = NN
+		emitMem(0xC6, 0, vx); emit(op.nn);
+		return true;
+
+	case 0x7000: // 7XNN: V[X] += NN
+		emitMem(0x80, 0, vx); emit(op.nn);
+		return true;
+
+	case 0x8000:
+		switch (op.n) {
+		case 0x0: // 8XY0: V[X] = V[Y]
+			emitMem(0x8A, AL, vy);
+			emitMem(0x88, AL, vx);
+			return true;
+		case 0x1: // 8XY1: V[X] |= V[Y]
+			emitMem(0x8A, AL, vy);
+			emitMem(0x08, AL, vx);
+			emitLogicFlag(vf);
+			return true;
+		case 0x2: // 8XY2: V[X] &= V[Y]
+			emitMem(0x8A, AL, vy);
+			emitMem(0x20, AL, vx);
+			emitLogicFlag(vf);
+			return true;
+		case 0x3: // 8XY3: V[X] ^= V[Y]
+			emitMem(0x8A, AL, vy);
+			emitMem(0x30, AL, vx);
+			emitLogicFlag(vf);
+			return true;
+		case 0x4: // 8XY4: V[F] = carry, V[X] += V[Y]
+			emitMem(0x8A, AL, vx);
+			emitMem(0x02, AL, vy);
+			emit(0x0F); emit(0x92); emit(0xC1);	// setc cl
+			emitMem(0x88, CL, vf);
+			emitMem(0x8A, AL, vx);
+			emitMem(0x02, AL, vy);
+			emitMem(0x88, AL, vx);
+			return true;
+		case 0x5: // 8XY5: V[F] = !borrow, V[X] -= V[Y]
+			emitMem(0x8A, AL, vx);
+			emitMem(0x3A, AL, vy);
+			emit(0x0F); emit(0x93); emit(0xC1);	// setae cl
+			emitMem(0x88, CL, vf);
+			emitMem(0x8A, AL, vx);
+			emitMem(0x2A, AL, vy);
+			emitMem(0x88, AL, vx);
+			return true;
+		case 0x6: // 8XY6: V[F] = LSB, V[X] >>= 1
+			emitShiftSource(vx, vy);
+			emitMem(0x8A, AL, vx);
+			emit(0x24); emit(0x01);				// and al, 1
+			emitMem(0x88, AL, vf);
+			emitMem(0xD0, 5, vx);				// shr byte [vx], 1
+			return true;
+		case 0x7: // 8XY7: V[F] = !borrow, V[X] = V[Y] - V[X]
+			emitMem(0x8A, AL, vy);
+			emitMem(0x3A, AL, vx);
+			emit(0x0F); emit(0x93); emit(0xC1);	// setae cl
+			emitMem(0x88, CL, vf);
+			emitMem(0x8A, AL, vy);
+			emitMem(0x2A, AL, vx);
+			emitMem(0x88, AL, vx);
+			return true;
+		case 0xE: // 8XYE: V[F] = MSB, V[X] <<= 1
+			emitShiftSource(vx, vy);
+			emitMem(0x8A, AL, vx);
+			emit(0xC0); emit(0xE8); emit(0x07);	// shr al, 7
+			emitMem(0x88, AL, vf);
+			emitMem(0xD0, 4, vx);				// shl byte [vx], 1
+			return true;
+		}
+		return false;
+
+	case 0xA000: // ANNN: I = NNN
+		emit(0x66); emitMem(0xC7, 0, offI); emit16(op.nnn);
+		return true;
+
+	case 0xF000:
+		switch (op.nn) {
+		case 0x07: // FX07: V[X] = delay timer
+			emitMem(0x8A, AL, offDelay);
+			emitMem(0x88, AL, vx);
+			return true;
+		case 0x15: // FX15: delay timer = V[X]
+			emitMem(0x8A, AL, vx);
+			emitMem(0x88, AL, offDelay);
+			return true;
+		case 0x18: // FX18: sound timer = V[X]
+			emitMem(0x8A, AL, vx);
+			emitMem(0x88, AL, offSound);
+			return true;
+		case 0x1E: // FX1E: V[F] = I + V[X] > 0xFFF, I += V[X]
+			if (!quirks.addIFlagsOverflow) {
+				emit(0x0F); emitMem(0xB6, CL, vx);		// movzx ecx, byte [vx]
+				emit(0x66); emitMem(0x01, CL, offI);	// add word [I], cx
+				return true;
+			}
+			emit(0x0F); emitMem(0xB7, AL, offI);	// movzx eax, word [I]
+			emit(0x0F); emitMem(0xB6, CL, vx);		// movzx ecx, byte [vx]
+			emit(0x01); emit(0xC8);					// add eax, ecx
+			emit(0x3D); emit32(0xFFF);				// cmp eax, 0xFFF
+			emit(0x0F); emit(0x97); emit(0xC2);		// seta dl
+			emitMem(0x88, DL, vf);
+			emit(0x0F); emitMem(0xB6, CL, vx);		// movzx ecx, byte [vx]
+			emit(0x66); emitMem(0x01, CL, offI);	// add word [I], cx
+			return true;
+		case 0x29: // FX29: I = V[X] * 5
+			emit(0x0F); emitMem(0xB6, AL, vx);		// movzx eax, byte [vx]
+			emit(0x8D); emit(0x04); emit(0x80);		// lea eax, [rax + rax * 4]
+			emit(0x66); emitMem(0x89, AL, offI);	// mov word [I], ax
+			return true;
+		}
+		return false;
+	}
+
+	return false;
+}
+
+bool Chip8Jit::compile(const Chip8& c8, Chip8Block& block, const Chip8Op * ops) {
+#if CHIP8_JIT_AVAILABLE
+	if (buffer == NULL)
+		return false;
+
+	// Worst case per op: a pc update and a handler call, or the longest inline op
+	const size_t maxOpBytes = 64;
+	used = (used + 15) & ~(size_t)15;
+	size_t need = block.length * (sizeof(Chip8Op) + maxOpBytes) + 32;
+	if (used + need > size)
+		return false;
+
+	offV = (int)((const unsigned char*)c8.V - (const unsigned char*)&c8);
+	offI = (int)((const unsigned char*)&c8.I - (const unsigned char*)&c8);
+	offPC = (int)((const unsigned char*)&c8.pc - (const unsigned char*)&c8);
+	offDelay = (int)((const unsigned char*)&c8.delay_timer - (const unsigned char*)&c8);
+	offSound = (int)((const unsigned char*)&c8.sound_timer - (const unsigned char*)&c8);
+	quirks = Chip8QuirkSet::of(c8.quirks);
+
+	protect(true);
+
+	// Ops passed to handlers live in the code buffer so they outlive the block cache's arena
+	Chip8Op * data = (Chip8Op*)(buffer + used);
+	memcpy(data, ops, block.length * sizeof(Chip8Op));
+	out = (unsigned char*)(data + block.length);
+	unsigned char * entry = out;
+
+#ifdef _WIN32
+	const unsigned char movArg0 = 0xD9, movArg1 = 0xBA;		// rcx, rdx
+	emit(0x53);												// push rbx
+	emit(0x48); emit(0x89); emit(0xCB);						// mov rbx, rcx
+	emit(0x48); emit(0x83); emit(0xEC); emit(0x20);			// sub rsp, 32 (shadow space)
+#else
+	const unsigned char movArg0 = 0xDF, movArg1 = 0xBE;		// rdi, rsi
+	emit(0x53);												// push rbx
+	emit(0x48); emit(0x89); emit(0xFB);						// mov rbx, rdi
+#endif
+
+	unsigned short pc = block.start;
+	bool pcDirty = false;
+	for (int i = 0; i < block.length; ++i) {
+		if (emitNative(ops[i])) {
+			pcDirty = true;
+		}
+		else {
+			// Handlers read and advance pc themselves
+			if (pcDirty) {
+				emit(0x66); emitMem(0xC7, 0, offPC); emit16(pc);
+				pcDirty = false;
+			}
+			emit(0x48); emit(0x89); emit(movArg0);					// mov arg0, rbx
+			emit(0x48); emit(movArg1); emit64((unsigned long long)&data[i]);	// mov arg1, &op
+			emitCall((const void*)ops[i].exec);
+		}
+		pc += 2;
+	}
+	if (pcDirty) {
+		emit(0x66); emitMem(0xC7, 0, offPC); emit16(pc);
+	}
+
+#ifdef _WIN32
+	emit(0x48); emit(0x83); emit(0xC4); emit(0x20);			// add rsp, 32
+#endif
+	emit(0x5B);												// pop rbx
+	emit(0xC3);												// ret
+
+	used = out - buffer;
+	protect(false);
+
+	block.native = (void(*)(Chip8*))entry;
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Chip8.h"
+
+struct Chip8Block;
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_AVAILABLE 1
+#else
+#define CHIP8_JIT_AVAILABLE 0
+#endif
+
+// Recompiles hot blocks from the translation cache into native x86-64 code.
+// Register, timer and index instructions are emitted inline against the Chip8
+// instance; everything else (drawing, keys, memory and control flow) calls the
+// interpreter's handler for that op.
+class Chip8Jit {
+
+public:
+	Chip8Jit();
+	~Chip8Jit();
+
+	// Number of times a block is interpreted before it gets compiled
+	static const unsigned int threshold = 32;
+
+	static bool available() { return CHIP8_JIT_AVAILABLE != 0; }
+
+	// Emits native code for block and stores the entry point in it. Returns false
+	// when the code buffer is full; call reset() after flushing the block cache.
+	bool compile(const Chip8& c8, Chip8Block& block, const Chip8Op * ops);
+	void reset();
+
+private:
+	unsigned char * buffer;		// Executable code buffer
+	size_t size;
+	size_t used;
+
+	// Byte offsets of the registers inside Chip8
+	int offV, offI, offPC, offDelay, offSound;
+	Chip8QuirkSet quirks;		// Profile of the instance being compiled for
+
+	unsigned char * out;
+	void emit(unsigned char b) { *out++ = b; }
+	void emit16(unsigned short v);
+	void emit32(unsigned int v);
+	void emit64(unsigned long long v);
+	void emitMem(unsigned char op, unsigned char reg, int offset);
+	void emitCall(const void * function);
+	bool emitNative(const Chip8Op& op);
+	void emitLogicFlag(int vf);
+	void emitShiftSource(int vx, int vy);
+
+	void protect(bool writable);
+};
@@ -0,0 +1,497 @@
+#include "Chip8Lockstep.h"
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Vector helpers. Byte ops work on vecBytes lanes at a time; 16 bit ops on vecBytes / 2.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i Chip8Vec;
+static const int vecBytes = 32;
+
+static inline Chip8Vec vload(const void * p) { return _mm256_load_si256((const __m256i*)p); }
+static inline void vstore(void * p, Chip8Vec v) { _mm256_store_si256((__m256i*)p, v); }
+static inline Chip8Vec vset8(unsigned char b) { return _mm256_set1_epi8((char)b); }
+static inline Chip8Vec vset16(unsigned short w) { return _mm256_set1_epi16((short)w); }
+static inline Chip8Vec vadd8(Chip8Vec a, Chip8Vec b) { return _mm256_add_epi8(a, b); }
+static inline Chip8Vec vsub8(Chip8Vec a, Chip8Vec b) { return _mm256_sub_epi8(a, b); }
+static inline Chip8Vec vadds8(Chip8Vec a, Chip8Vec b) { return _mm256_adds_epu8(a, b); }
+static inline Chip8Vec vsubs8(Chip8Vec a, Chip8Vec b) { return _mm256_subs_epu8(a, b); }
+static inline Chip8Vec vmax8(Chip8Vec a, Chip8Vec b) { return _mm256_max_epu8(a, b); }
+static inline Chip8Vec veq8(Chip8Vec a, Chip8Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Chip8Vec vadd16(Chip8Vec a, Chip8Vec b) { return _mm256_add_epi16(a, b); }
+static inline Chip8Vec veq16(Chip8Vec a, Chip8Vec b) { return _mm256_cmpeq_epi16(a, b); }
+static inline Chip8Vec vand(Chip8Vec a, Chip8Vec b) { return _mm256_and_si256(a, b); }
+static inline Chip8Vec vandnot(Chip8Vec a, Chip8Vec b) { return _mm256_andnot_si256(a, b); }
+static inline Chip8Vec vor(Chip8Vec a, Chip8Vec b) { return _mm256_or_si256(a, b); }
+static inline Chip8Vec vxor(Chip8Vec a, Chip8Vec b) { return _mm256_xor_si256(a, b); }
+static inline Chip8Vec vsrl16(Chip8Vec a, int bits) { return _mm256_srli_epi16(a, bits); }
+static inline Chip8Vec vblend(Chip8Vec a, Chip8Vec b, Chip8Vec mask) { return _mm256_blendv_epi8(a, b, mask); }
+// Loads vecBytes / 2 byte masks and widens each one to 16 bits
+static inline Chip8Vec vwiden(const unsigned char * p) { return _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)p)); }
+// One bit per 16 bit lane of lo followed by hi, for 16 bit masks
+static inline uint32_t vbits16(Chip8Vec lo, Chip8Vec hi) {
+	return (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+typedef __m128i Chip8Vec;
+static const int vecBytes = 16;
+
+static inline Chip8Vec vload(const void * p) { return _mm_load_si128((const __m128i*)p); }
+static inline void vstore(void * p, Chip8Vec v) { _mm_store_si128((__m128i*)p, v); }
+static inline Chip8Vec vset8(unsigned char b) { return _mm_set1_epi8((char)b); }
+static inline Chip8Vec vset16(unsigned short w) { return _mm_set1_epi16((short)w); }
+static inline Chip8Vec vadd8(Chip8Vec a, Chip8Vec b) { return _mm_add_epi8(a, b); }
+static inline Chip8Vec vsub8(Chip8Vec a, Chip8Vec b) { return _mm_sub_epi8(a, b); }
+static inline Chip8Vec vadds8(Chip8Vec a, Chip8Vec b) { return _mm_adds_epu8(a, b); }
+static inline Chip8Vec vsubs8(Chip8Vec a, Chip8Vec b) { return _mm_subs_epu8(a, b); }
+static inline Chip8Vec vmax8(Chip8Vec a, Chip8Vec b) { return _mm_max_epu8(a, b); }
+static inline Chip8Vec veq8(Chip8Vec a, Chip8Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline Chip8Vec vadd16(Chip8Vec a, Chip8Vec b) { return _mm_add_epi16(a, b); }
+static inline Chip8Vec veq16(Chip8Vec a, Chip8Vec b) { return _mm_cmpeq_epi16(a, b); }
+static inline Chip8Vec vand(Chip8Vec a, Chip8Vec b) { return _mm_and_si128(a, b); }
+static inline Chip8Vec vandnot(Chip8Vec a, Chip8Vec b) { return _mm_andnot_si128(a, b); }
+static inline Chip8Vec vor(Chip8Vec a, Chip8Vec b) { return _mm_or_si128(a, b); }
+static inline Chip8Vec vxor(Chip8Vec a, Chip8Vec b) { return _mm_xor_si128(a, b); }
+static inline Chip8Vec vsrl16(Chip8Vec a, int bits) { return _mm_srli_epi16(a, bits); }
+static inline Chip8Vec vblend(Chip8Vec a, Chip8Vec b, Chip8Vec mask) { return vor(vand(mask, b), vandnot(mask, a)); }
+static inline Chip8Vec vwiden(const unsigned char * p) {
+	Chip8Vec v = _mm_loadl_epi64((const __m128i*)p);
+	return _mm_unpacklo_epi8(v, v);
+}
+static inline uint32_t vbits16(Chip8Vec lo, Chip8Vec hi) { return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)); }
+
+#else
+// Portable fallback, plain loops the compiler can vectorize for the target
+struct Chip8Vec { alignas(16) unsigned char b[16]; };
+static const int vecBytes = 16;
+
+#define CHIP8_VEC_BYTES(expr) Chip8Vec r; for (int i = 0; i < 16; ++i) r.b[i] = (unsigned char)(expr); return r
+#define CHIP8_VEC_WORDS(expr) Chip8Vec r; unsigned short a16[8], b16[8], r16[8]; memcpy(a16, a.b, 16); memcpy(b16, b.b, 16); \
+	for (int i = 0; i < 8; ++i) r16[i] = (unsigned short)(expr); memcpy(r.b, r16, 16); return r
+
+static inline Chip8Vec vload(const void * p) { Chip8Vec r; memcpy(r.b, p, 16); return r; }
+static inline void vstore(void * p, Chip8Vec v) { memcpy(p, v.b, 16); }
+static inline Chip8Vec vset8(unsigned char v) { CHIP8_VEC_BYTES(v); }
+static inline Chip8Vec vset16(unsigned short w) { Chip8Vec r; for (int i = 0; i < 16; ++i) r.b[i] = (unsigned char)(i & 1 ? w >> 8 : w); return r; }
+static inline Chip8Vec vadd8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] + b.b[i]); }
+static inline Chip8Vec vsub8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] - b.b[i]); }
+static inline Chip8Vec vadds8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] + b.b[i] > 0xFF ? 0xFF : a.b[i] + b.b[i]); }
+static inline Chip8Vec vsubs8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] > b.b[i] ? a.b[i] - b.b[i] : 0); }
+static inline Chip8Vec vmax8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] > b.b[i] ? a.b[i] : b.b[i]); }
+static inline Chip8Vec veq8(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] == b.b[i] ? 0xFF : 0); }
+static inline Chip8Vec vadd16(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_WORDS(a16[i] + b16[i]); }
+static inline Chip8Vec veq16(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_WORDS(a16[i] == b16[i] ? 0xFFFF : 0); }
+static inline Chip8Vec vand(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] & b.b[i]); }
+static inline Chip8Vec vandnot(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(~a.b[i] & b.b[i]); }
+static inline Chip8Vec vor(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] | b.b[i]); }
+static inline Chip8Vec vxor(Chip8Vec a, Chip8Vec b) { CHIP8_VEC_BYTES(a.b[i] ^ b.b[i]); }
+static inline Chip8Vec vsrl16(Chip8Vec a, int bits) { Chip8Vec b = a; CHIP8_VEC_WORDS(a16[i] >> bits); }
+static inline Chip8Vec vblend(Chip8Vec a, Chip8Vec b, Chip8Vec mask) { return vor(vand(mask, b), vandnot(mask, a)); }
+static inline Chip8Vec vwiden(const unsigned char * p) { CHIP8_VEC_BYTES(p[i >> 1]); }
+static inline uint32_t vbits16(Chip8Vec lo, Chip8Vec hi) {
+	uint32_t bits = 0;
+	for (int i = 0; i < 8; ++i)
+		bits |= (lo.b[i * 2] & 1u) << i | (hi.b[i * 2] & 1u) << (i + 8);
+	return bits;
+}
+
+#undef CHIP8_VEC_BYTES
+#undef CHIP8_VEC_WORDS
+#endif
+
+static inline int lowestLane(uint32_t lanes) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, lanes);
+	return (int)index;
+#else
+	return __builtin_ctz(lanes);
+#endif
+}
+
+static inline int highestLane(uint32_t lanes) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, lanes);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(lanes);
+#endif
+}
+
+static inline int laneCount(uint32_t lanes) {
+	int count = 0;
+	for (; lanes != 0; lanes &= lanes - 1)
+		++count;
+	return count;
+}
+
+// Kernel for every opcode, matched on the handler the dispatch table picked so both always agree.
+// The kernels implement the default quirk profile, which is what every lane runs.
+struct Chip8KernelTable {
+	Chip8Kernel kernels[0x10000];
+	Chip8KernelTable();
+};
+
+Chip8KernelTable::Chip8KernelTable() {
+	typedef void(*Exec)(Chip8&, const Chip8Op&);
+	const struct { Exec exec; Chip8Kernel kernel; } map[] = {
+		{ &Chip8::call<&Chip8::jump>, Chip8Kernel::Jump },
+		{ &Chip8::call<&Chip8::skipVXisNN>, Chip8Kernel::SkipVXisNN },
+		{ &Chip8::call<&Chip8::skipVXnotNN>, Chip8Kernel::SkipVXnotNN },
+		{ &Chip8::call<&Chip8::skipVXisVY>, Chip8Kernel::SkipVXisVY },
+		{ &Chip8::call<&Chip8::skipVXisntVY>, Chip8Kernel::SkipVXisntVY },
+		{ &Chip8::call<&Chip8::setVXtoNN>, Chip8Kernel::SetVXtoNN },
+		{ &Chip8::call<&Chip8::addVXNN>, Chip8Kernel::AddVXNN },
+		{ &Chip8::call<&Chip8::setVXtoVY>, Chip8Kernel::SetVXtoVY },
+		{ &Chip8::call<&Chip8::VXorVY<Chip8Quirks::Default>>, Chip8Kernel::VXorVY },
+		{ &Chip8::call<&Chip8::VXandVY<Chip8Quirks::Default>>, Chip8Kernel::VXandVY },
+		{ &Chip8::call<&Chip8::VXxorXY<Chip8Quirks::Default>>, Chip8Kernel::VXxorVY },
+		{ &Chip8::call<&Chip8::addVXVY>, Chip8Kernel::AddVXVY },
+		{ &Chip8::call<&Chip8::subVXVY>, Chip8Kernel::SubVXVY },
+		{ &Chip8::call<&Chip8::rightShift<Chip8Quirks::Default>>, Chip8Kernel::RightShift },
+		{ &Chip8::call<&Chip8::subVYVX>, Chip8Kernel::SubVYVX },
+		{ &Chip8::call<&Chip8::leftShift<Chip8Quirks::Default>>, Chip8Kernel::LeftShift },
+		{ &Chip8::call<&Chip8::setAddr>, Chip8Kernel::SetAddr },
+		{ &Chip8::call<&Chip8::getDelay>, Chip8Kernel::GetDelay },
+		{ &Chip8::call<&Chip8::setDelay>, Chip8Kernel::SetDelay },
+		{ &Chip8::call<&Chip8::setSound>, Chip8Kernel::SetSound },
+	};
+
+	for (unsigned int i = 0; i < 0x10000; ++i) {
+		Exec exec = Chip8::decode((unsigned short)i).exec;
+		kernels[i] = Chip8Kernel::Scalar;
+		for (const auto & entry : map) {
+			if (entry.exec == exec)
+				kernels[i] = entry.kernel;
+		}
+	}
+}
+
+static const Chip8KernelTable & kernelTable() {
+	static const Chip8KernelTable table;
+	return table;
+}
+
+template <int Lanes>
+Chip8Lockstep<Lanes>::Chip8Lockstep() : cyclesPerFrame(10), vectorSteps(0), scalarSteps(0), matchLanes(0) {
+	memset(V, 0, sizeof(V));
+	memset(I, 0, sizeof(I));
+	memset(pc, 0, sizeof(pc));
+	memset(sp, 0, sizeof(sp));
+	memset(delay_timer, 0, sizeof(delay_timer));
+	memset(sound_timer, 0, sizeof(sound_timer));
+	memset(match, 0, sizeof(match));
+	memset(cond, 0, sizeof(cond));
+	memset(pageWriters, 0, sizeof(pageWriters));
+	image = Chip8Image::create(NULL, 0);
+	kernelTable();
+}
+
+template <int Lanes>
+bool Chip8Lockstep<Lanes>::loadApplication(const unsigned char * data, size_t size) {
+	image = Chip8Image::create(data, size);
+	for (int l = 0; l < Lanes; ++l) {
+		if (!machines[l].loadApplication(image))
+			return false;
+		gather(l);
+	}
+	memset(pageWriters, 0, sizeof(pageWriters));
+	vectorSteps = 0;
+	scalarSteps = 0;
+	return true;
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::seedRandom(int lane, uint64_t seed) {
+	machines[lane].seedRandom(seed);
+}
+
+template <int Lanes>
+Chip8 & Chip8Lockstep<Lanes>::lane(int index) {
+	scatter(index);
+	return machines[index];
+}
+
+// Lane registers out to the lane's machine
+template <int Lanes>
+void Chip8Lockstep<Lanes>::scatter(int index) {
+	Chip8 & c8 = machines[index];
+	for (int i = 0; i < 16; ++i)
+		c8.V[i] = V[i][index];
+	c8.I = I[index];
+	c8.pc = pc[index];
+	c8.sp = sp[index];
+	c8.delay_timer = delay_timer[index];
+	c8.sound_timer = sound_timer[index];
+}
+
+// The lane's machine registers back into the lane arrays
+template <int Lanes>
+void Chip8Lockstep<Lanes>::gather(int index) {
+	const Chip8 & c8 = machines[index];
+	for (int i = 0; i < 16; ++i)
+		V[i][index] = c8.V[i];
+	I[index] = c8.I;
+	pc[index] = c8.pc;
+	sp[index] = (unsigned char)c8.sp;
+	delay_timer[index] = c8.delay_timer;
+	sound_timer[index] = c8.sound_timer;
+}
+
+// Runs op's handler on one lane. Only the registers the handlers without a kernel can touch
+// are copied across: V0 (BNNN), VX, VY, VF, I, pc and sp, or V0 to VX for FX55 and FX65.
+template <int Lanes>
+void Chip8Lockstep<Lanes>::stepLane(int index, const Chip8Op& op) {
+	Chip8 & c8 = machines[index];
+	bool registerRange = (op.opcode & 0xF0FF) == 0xF055 || (op.opcode & 0xF0FF) == 0xF065;
+
+	if (registerRange) {
+		for (int i = 0; i <= op.x; ++i)
+			c8.V[i] = V[i][index];
+	}
+	else {
+		c8.V[0] = V[0][index];
+		c8.V[op.x] = V[op.x][index];
+		c8.V[op.y] = V[op.y][index];
+		c8.V[0xF] = V[0xF][index];
+	}
+	unsigned short start = I[index];
+	c8.I = start;
+	c8.pc = pc[index];
+	c8.sp = sp[index];
+	c8.opcode = op.opcode;
+
+	op.exec(c8, op);
+
+	if (registerRange) {
+		for (int i = 0; i <= op.x; ++i)
+			V[i][index] = c8.V[i];
+	}
+	else {
+		V[0][index] = c8.V[0];
+		V[op.x][index] = c8.V[op.x];
+		V[op.y][index] = c8.V[op.y];
+		V[0xF][index] = c8.V[0xF];
+	}
+	I[index] = c8.I;
+	pc[index] = c8.pc;
+	sp[index] = (unsigned char)c8.sp;
+
+	// FX33 and FX55 are the only instructions that write to memory. The pages they wrote to
+	// may no longer match the other lanes.
+	if ((op.opcode & 0xF0FF) == 0xF033 || (op.opcode & 0xF0FF) == 0xF055) {
+		int count = (op.opcode & 0xF0FF) == 0xF033 ? 3 : op.x + 1;
+		for (int i = 0; i < count; ++i)
+			pageWriters[((start + i) & 0xFFF) >> 6] |= 1u << index;
+	}
+	++scalarSteps;
+}
+
+// Runs op on every lane set in match
+template <int Lanes>
+void Chip8Lockstep<Lanes>::stepGroup(Chip8Kernel kernel, const Chip8Op& op) {
+	// Only the vectors holding lanes of the group are touched
+	const int first = lowestLane(matchLanes), last = highestLane(matchLanes);
+	const int begin8 = first & ~(vecBytes - 1), end8 = (last | (vecBytes - 1)) + 1;
+	const int begin16 = first & ~(vecBytes / 2 - 1), end16 = (last | (vecBytes / 2 - 1)) + 1;
+	const Chip8Vec one = vset8(1);
+	unsigned char * vx = V[op.x];
+	unsigned char * vy = V[op.y];
+	unsigned char * vf = V[0xF];
+
+	switch (kernel) {
+	// 0x1NNN: Jumps to address NNN
+	case Chip8Kernel::Jump:
+		for (int b = begin16; b < end16; b += vecBytes / 2) {
+			Chip8Vec m = vwiden(match + b);
+			vstore(pc + b, vblend(vload(pc + b), vset16(op.nnn), m));
+		}
+		return;
+
+	// 0x3XNN, 0x4XNN, 0x5XY0, 0x9XY0: Skips the next instruction when the condition holds
+	case Chip8Kernel::SkipVXisNN:
+	case Chip8Kernel::SkipVXnotNN:
+	case Chip8Kernel::SkipVXisVY:
+	case Chip8Kernel::SkipVXisntVY:
+		for (int b = begin8; b < end8; b += vecBytes) {
+			Chip8Vec x = vload(vx + b);
+			Chip8Vec equal = veq8(x, kernel == Chip8Kernel::SkipVXisNN || kernel == Chip8Kernel::SkipVXnotNN ? vset8(op.nn) : vload(vy + b));
+			bool invert = kernel == Chip8Kernel::SkipVXnotNN || kernel == Chip8Kernel::SkipVXisntVY;
+			vstore(cond + b, invert ? vxor(equal, vset8(0xFF)) : equal);
+		}
+		for (int b = begin16; b < end16; b += vecBytes / 2) {
+			Chip8Vec m = vwiden(match + b);
+			Chip8Vec step = vadd16(vset16(2), vand(vwiden(cond + b), vset16(2)));
+			Chip8Vec p = vload(pc + b);
+			vstore(pc + b, vblend(p, vadd16(p, step), m));
+		}
+		return;
+
+	default:
+		break;
+	}
+
+	for (int b = begin8; b < end8; b += vecBytes) {
+		Chip8Vec m = vload(match + b);
+		Chip8Vec x = vload(vx + b);
+		Chip8Vec y = vload(vy + b);
+
+		switch (kernel) {
+		case Chip8Kernel::SetVXtoNN: // 0x6XNN: Sets V[X] to NN
+			vstore(vx + b, vblend(x, vset8(op.nn), m));
+			break;
+		case Chip8Kernel::AddVXNN: // 0x7XNN: Adds NN to VX
+			vstore(vx + b, vblend(x, vadd8(x, vset8(op.nn)), m));
+			break;
+		case Chip8Kernel::SetVXtoVY: // 0x8XY0: Sets V[X] to the value of V[Y]
+			vstore(vx + b, vblend(x, y, m));
+			break;
+		case Chip8Kernel::VXorVY: // 0x8XY1: Sets V[X] to V[X] or V[Y]
+			vstore(vx + b, vblend(x, vor(x, y), m));
+			break;
+		case Chip8Kernel::VXandVY: // 0x8XY2: Sets V[X] to V[X] and V[Y]
+			vstore(vx + b, vblend(x, vand(x, y), m));
+			break;
+		case Chip8Kernel::VXxorVY: // 0x8XY3: Sets V[X] to V[X] xor V[Y]
+			vstore(vx + b, vblend(x, vxor(x, y), m));
+			break;
+
+		// V[F] is written before the result, as in the scalar handlers, so X or Y being F
+		// sees the new flag
+		case Chip8Kernel::AddVXVY: // 0x8XY4: V[F] = carry, V[X] += V[Y]
+			vstore(vf + b, vblend(vload(vf + b), vandnot(veq8(vadds8(x, y), vadd8(x, y)), one), m));
+			x = vload(vx + b);
+			y = vload(vy + b);
+			vstore(vx + b, vblend(x, vadd8(x, y), m));
+			break;
+		case Chip8Kernel::SubVXVY: // 0x8XY5: V[F] = !borrow, V[X] -= V[Y]
+			vstore(vf + b, vblend(vload(vf + b), vand(veq8(vmax8(x, y), x), one), m));
+			x = vload(vx + b);
+			y = vload(vy + b);
+			vstore(vx + b, vblend(x, vsub8(x, y), m));
+			break;
+		case Chip8Kernel::RightShift: // 0x8XY6: V[F] = LSB, V[X] >>= 1
+			vstore(vf + b, vblend(vload(vf + b), vand(x, one), m));
+			x = vload(vx + b);
+			vstore(vx + b, vblend(x, vand(vsrl16(x, 1), vset8(0x7F)), m));
+			break;
+		case Chip8Kernel::SubVYVX: // 0x8XY7: V[F] = !borrow, V[X] = V[Y] - V[X]
+			vstore(vf + b, vblend(vload(vf + b), vand(veq8(vmax8(x, y), y), one), m));
+			x = vload(vx + b);
+			y = vload(vy + b);
+			vstore(vx + b, vblend(x, vsub8(y, x), m));
+			break;
+		case Chip8Kernel::LeftShift: // 0x8XYE: V[F] = MSB, V[X] <<= 1
+			vstore(vf + b, vblend(vload(vf + b), vand(vsrl16(x, 7), one), m));
+			x = vload(vx + b);
+			vstore(vx + b, vblend(x, vadd8(x, x), m));
+			break;
+
+		case Chip8Kernel::GetDelay: // FX07: Sets V[X] to the value of the delay timer
+			vstore(vx + b, vblend(x, vload(delay_timer + b), m));
+			break;
+		case Chip8Kernel::SetDelay: // FX15: Sets the delay timer to V[X]
+			vstore(delay_timer + b, vblend(vload(delay_timer + b), x, m));
+			break;
+		case Chip8Kernel::SetSound: // FX18: Sets the sound timer to V[X]
+			vstore(sound_timer + b, vblend(vload(sound_timer + b), x, m));
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (int b = begin16; b < end16; b += vecBytes / 2) {
+		Chip8Vec m = vwiden(match + b);
+		if (kernel == Chip8Kernel::SetAddr) // ANNN: Sets I to the address of NNN
+			vstore(I + b, vblend(vload(I + b), vset16(op.nnn), m));
+		Chip8Vec p = vload(pc + b);
+		vstore(pc + b, vblend(p, vadd16(p, vset16(2)), m));
+	}
+}
+
+// Lanes whose pc equals address
+template <int Lanes>
+uint32_t Chip8Lockstep<Lanes>::lanesAt(unsigned short address) const {
+	const int span = Lanes < vecBytes ? vecBytes : Lanes;
+	const Chip8Vec target = vset16(address);
+	uint32_t lanes = 0;
+	for (int b = 0; b < span; b += vecBytes)
+		lanes |= vbits16(veq16(vload(pc + b), target), veq16(vload(pc + b + vecBytes / 2), target)) << b;
+	return lanes;
+}
+
+// Lanes are grouped by the instruction at their pc. Groups with a kernel run through it,
+// however few lanes they hold; everything else runs one lane at a time.
+template <int Lanes>
+void Chip8Lockstep<Lanes>::step() {
+	uint32_t remaining = 0xFFFFFFFFu >> (32 - Lanes);
+
+	while (remaining != 0) {
+		int leader = lowestLane(remaining);
+		unsigned short address = pc[leader] & 0xFFF;
+		unsigned short next = (address + 1) & 0xFFF;
+
+		// Lanes that never wrote to the pages holding this instruction still share the loaded code
+		uint32_t writers = pageWriters[address >> 6] | pageWriters[next >> 6];
+		unsigned short opcode = (writers >> leader) & 1 ? machines[leader].readOpcode(address)
+			: image->bytes[address] << 8 | image->bytes[next];
+
+		uint32_t group = lanesAt(pc[leader]) & remaining;
+		uint32_t verify = (writers >> leader) & 1 ? group : group & writers;
+		for (; verify != 0; verify &= verify - 1) {
+			int l = lowestLane(verify);
+			if (machines[l].readOpcode(address) != opcode)
+				group &= ~(1u << l);
+		}
+		remaining &= ~group;
+
+		const Chip8Op & op = Chip8::decode(opcode);
+		Chip8Kernel kernel = kernelTable().kernels[opcode];
+		if (kernel == Chip8Kernel::Scalar) {
+			for (; group != 0; group &= group - 1)
+				stepLane(lowestLane(group), op);
+			continue;
+		}
+
+		// Lanes in lock-step keep the same mask from one instruction to the next
+		if (group != matchLanes) {
+			memset(match, 0, sizeof(match));
+			for (uint32_t lanes = group; lanes != 0; lanes &= lanes - 1)
+				match[lowestLane(lanes)] = 0xFF;
+			matchLanes = group;
+		}
+		stepGroup(kernel, op);
+		vectorSteps += laneCount(group);
+	}
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::runFrame() {
+	for (unsigned int i = 0; i < cyclesPerFrame; ++i)
+		step();
+
+	// Timers tick on every lane at once; the beep flag and frame count live on each lane's machine
+	for (int l = 0; l < Lanes; ++l) {
+		if (sound_timer[l] == 1)
+			machines[l].playBeep = true;
+		++machines[l].frames;
+	}
+	const Chip8Vec one = vset8(1);
+	for (int b = 0; b < width; b += vecBytes) {
+		vstore(delay_timer + b, vsubs8(vload(delay_timer + b), one));
+		vstore(sound_timer + b, vsubs8(vload(sound_timer + b), one));
+	}
+}
+
+template class Chip8Lockstep<8>;
+template class Chip8Lockstep<16>;
+template class Chip8Lockstep<32>;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Chip8.h"
+
+// Instructions with a SIMD kernel, everything else runs one lane at a time
+enum class Chip8Kernel : unsigned char {
+	Scalar, Jump, SkipVXisNN, SkipVXnotNN, SkipVXisVY, SkipVXisntVY,
+	SetVXtoNN, AddVXNN, SetVXtoVY, VXorVY, VXandVY, VXxorVY, AddVXVY, SubVXVY, RightShift, SubVYVX, LeftShift,
+	SetAddr, GetDelay, SetDelay, SetSound
+};
+
+// Steps Lanes copies of the same application in lock-step (Lanes is 8, 16 or 32).
+// V, I, pc, sp and the timers live in lane-parallel arrays. Lanes at the same pc running
+// the same opcode execute it together with SSE2/AVX2 kernels when it is one of the
+// register, skip, jump or timer ops. Everything else, and any lane that has diverged
+// from the others, runs one lane at a time through the scalar Chip8 handlers, so every
+// lane ends up exactly where a Chip8 of its own would. Lanes run the default quirk profile.
+template <int Lanes>
+class Chip8Lockstep {
+	static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32, "Lanes must be 8, 16 or 32");
+
+public:
+	Chip8Lockstep();
+
+	unsigned int cyclesPerFrame;		// Instructions executed per 60 Hz frame
+
+	unsigned long long vectorSteps;		// Lane-instructions executed by the SIMD kernels
+	unsigned long long scalarSteps;		// Lane-instructions executed one lane at a time
+
+	bool loadApplication(const unsigned char * data, size_t size);
+	void seedRandom(int lane, uint64_t seed);
+
+	void step();		// One instruction on every lane
+	void runFrame();	// cyclesPerFrame instructions on every lane followed by a timer update
+
+	// The lane's machine with its registers brought up to date. Keys, screen and memory
+	// live there; register writes made through it are not picked up.
+	Chip8 & lane(int index);
+	unsigned long long frameHash(int index) const { return machines[index].frameHash(); }
+
+private:
+	// Rows are padded to the widest vector so kernels never need a partial load
+	static const int width = 32;
+
+	alignas(32) unsigned char  V[16][width];
+	alignas(32) unsigned short I[width];
+	alignas(32) unsigned short pc[width];
+	alignas(32) unsigned char  sp[width];
+	alignas(32) unsigned char  delay_timer[width];
+	alignas(32) unsigned char  sound_timer[width];
+
+	// Lanes taking part in the current kernel, 0xFF each, and the per-lane result of a skip test
+	alignas(32) unsigned char  match[width];
+	alignas(32) unsigned char  cond[width];
+	uint32_t matchLanes;	// Lanes set in match
+
+	// Memory as loaded, shared by every lane, and for each 64 byte page the lanes that have
+	// written to it since. Lanes that haven't written to a page still read the image there.
+	std::shared_ptr<const Chip8Image> image;
+	uint32_t pageWriters[64];
+
+	Chip8 machines[Lanes];
+
+	void scatter(int index);
+	void gather(int index);
+	void stepLane(int index, const Chip8Op& op);
+	void stepGroup(Chip8Kernel kernel, const Chip8Op& op);
+	uint32_t lanesAt(unsigned short address) const;
+};
@@ -0,0 +1,112 @@
+#include "Chip8Profile.h"
+#include <string.h>
+#include <algorithm>
+
+static const char * classNames[16] = {
+	"0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+	"8XYN", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EXNN", "FXNN"
+};
+
+Chip8Profiler::Chip8Profiler() {
+	clear();
+}
+
+void Chip8Profiler::clear() {
+	instructions = 0;
+	memset(classes, 0, sizeof(classes));
+	memset(pcs, 0, sizeof(pcs));
+
+	Chip8ProfileNode root = { 0, 0x200, 0, 1, 0 };
+	nodes.assign(1, root);
+	children.clear();
+	current = 0;
+	overflow = 0;
+}
+
+void Chip8Profiler::enter(unsigned short address) {
+	if (nodes[current].depth >= maxDepth) {
+		++overflow;
+		return;
+	}
+
+	uint64_t key = (uint64_t)current << 12 | address;
+	auto found = children.find(key);
+	if (found != children.end()) {
+		current = found->second;
+		++nodes[current].calls;
+		return;
+	}
+
+	Chip8ProfileNode node = { current, address, (uint16_t)(nodes[current].depth + 1), 1, 0 };
+	nodes.push_back(node);
+	current = (uint32_t)(nodes.size() - 1);
+	children[key] = current;
+}
+
+void Chip8Profiler::writeStack(FILE * file, uint32_t node) const {
+	if (node != 0) {
+		writeStack(file, nodes[node].parent);
+		fprintf(file, ";sub_%04X", nodes[node].address);
+	}
+	else
+		fprintf(file, "main");
+}
+
+bool Chip8Profiler::writeFolded(const char * filename) const {
+	FILE * file = fopen(filename, "w");
+	if (file == NULL)
+		return false;
+
+	for (uint32_t i = 0; i < nodes.size(); ++i) {
+		if (nodes[i].count == 0)
+			continue;
+		writeStack(file, i);
+		fprintf(file, " %llu\n", nodes[i].count);
+	}
+	return fclose(file) == 0;
+}
+
+bool Chip8Profiler::writeJson(const char * filename) const {
+	FILE * file = fopen(filename, "w");
+	if (file == NULL)
+		return false;
+
+	fprintf(file, "{\n  \"instructions\": %llu,\n  \"classes\": {", instructions);
+	for (int i = 0; i < 16; ++i)
+		fprintf(file, "%s\n    \"%s\": %llu", i > 0 ? "," : "", classNames[i], classes[i]);
+	fprintf(file, "\n  },\n");
+
+	// The 32 most executed addresses
+	std::vector<unsigned short> hot;
+	for (unsigned short pc = 0; pc < 4096; ++pc) {
+		if (pcs[pc] != 0)
+			hot.push_back(pc);
+	}
+	size_t hotCount = std::min<size_t>(hot.size(), 32);
+	std::partial_sort(hot.begin(), hot.begin() + hotCount, hot.end(),
+		[this](unsigned short a, unsigned short b) { return pcs[a] > pcs[b]; });
+	fprintf(file, "  \"hotPcs\": [");
+	for (size_t i = 0; i < hotCount; ++i)
+		fprintf(file, "%s\n    { \"pc\": \"0x%03X\", \"count\": %llu }", i > 0 ? "," : "", hot[i], pcs[hot[i]]);
+	fprintf(file, "\n  ],\n");
+
+	// Subroutines by instructions executed in them, over every stack they appear in
+	std::vector<unsigned long long> self(4096), calls(4096);
+	for (size_t i = 1; i < nodes.size(); ++i) {
+		self[nodes[i].address] += nodes[i].count;
+		calls[nodes[i].address] += nodes[i].calls;
+	}
+	std::vector<unsigned short> subs;
+	for (unsigned short address = 0; address < 4096; ++address) {
+		if (calls[address] != 0)
+			subs.push_back(address);
+	}
+	std::sort(subs.begin(), subs.end(), [&self](unsigned short a, unsigned short b) { return self[a] > self[b]; });
+	fprintf(file, "  \"subroutines\": [");
+	for (size_t i = 0; i < subs.size(); ++i)
+		fprintf(file, "%s\n    { \"address\": \"0x%03X\", \"calls\": %llu, \"self\": %llu }", i > 0 ? "," : "",
+			subs[i], calls[subs[i]], self[subs[i]]);
+	fprintf(file, "\n  ],\n  \"stacks\": %zu\n}\n", nodes.size());
+
+	return fclose(file) == 0;
+}
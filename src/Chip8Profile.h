@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// A CHIP-8 call stack: the subroutine entered and the stack it was called from
+struct Chip8ProfileNode {
+	uint32_t parent;
+	uint16_t address;			// Subroutine entry point, 0x200 for the root
+	uint16_t depth;
+	unsigned long long calls;
+	unsigned long long count;	// Instructions executed in this frame, not counting callees
+};
+
+// Per-instance execution profile: instructions per opcode class (the top nibble, as in
+// emulateCycleSwitch), per pc and per call stack. Call stacks follow 2NNN and 00EE as they
+// execute, so the profile stays cheap: three counter increments per instruction.
+class Chip8Profiler {
+
+public:
+	Chip8Profiler();
+
+	void record(unsigned short pc, unsigned short opcode) {
+		++instructions;
+		++classes[opcode >> 12];
+		++pcs[pc & 0xFFF];
+		++nodes[current].count;
+		if ((opcode & 0xF000) == 0x2000)
+			enter(opcode & 0xFFF);
+		else if (opcode == 0x00EE) {
+			// Returns from calls that were folded in don't leave the frame
+			if (overflow > 0)
+				--overflow;
+			else
+				current = nodes[current].parent;
+		}
+	}
+
+	void clear();
+
+	// Folded stacks ("main;sub_0248;sub_02B4 1234" per line) for flamegraph tools
+	bool writeFolded(const char * filename) const;
+	// Totals, opcode classes, the hottest pcs and subroutines
+	bool writeJson(const char * filename) const;
+
+	unsigned long long instructions;
+	unsigned long long classes[16];
+	unsigned long long pcs[4096];
+
+private:
+	static const int maxDepth = 64;		// Deeper calls are folded into the frame that made them
+
+	std::vector<Chip8ProfileNode> nodes;	// nodes[0] is the root
+	std::unordered_map<uint64_t, uint32_t> children;	// (parent << 12 | address) to node
+	uint32_t current;
+	unsigned int overflow;		// Calls past maxDepth still to return
+
+	void enter(unsigned short address);
+	void writeStack(FILE * file, uint32_t node) const;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded single-producer/single-consumer queue. push() and pop() never block or
+// allocate; each side only writes its own index, so no locks are needed.
+template <typename T, size_t Capacity>
+class Chip8SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	Chip8SpscQueue() : head(0), tail(0) {}
+
+	// Producer side, returns false when the queue is full
+	bool push(const T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[h & (Capacity - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, returns false when the queue is empty
+	bool pop(T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t)
+			return false;
+		item = items[t & (Capacity - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, pops up to max items at once
+	size_t pop(T * out, size_t max) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t available = head.load(std::memory_order_acquire) - t;
+		size_t count = available < max ? available : max;
+		for (size_t i = 0; i < count; ++i)
+			out[i] = items[(t + i) & (Capacity - 1)];
+		tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	// Producer and consumer indices on separate cache lines
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) T items[Capacity];
+};
@@ -0,0 +1,132 @@
+#include "Chip8State.h"
+#include <stdio.h>
+#include <string.h>
+
+static_assert(sizeof(Chip8State) == 4440, "Chip8State must have no padding");
+
+bool Chip8State::save(const char * filename) const {
+	FILE * file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+
+	bool written = fwrite(this, sizeof(Chip8State), 1, file) == 1;
+	return fclose(file) == 0 && written;
+}
+
+bool Chip8State::load(const char * filename) {
+	FILE * file = fopen(filename, "rb");
+	if (file == NULL)
+		return false;
+
+	Chip8State state;
+	bool loaded = fread(&state, sizeof(Chip8State), 1, file) == 1 && memcmp(state.magic, "C8SS", 4) == 0 && state.version == 1;
+	fclose(file);
+
+	// A state no running instance could be in is corrupt. I is left alone, FX1E can take it past 0xFFF
+	if (loaded && (state.sp > 16 || state.pc > 0xFFE))
+		loaded = false;
+	if (loaded)
+		*this = state;
+	return loaded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+static void putCount(std::vector<unsigned char> & out, size_t count) {
+	while (count >= 0x80) {
+		out.push_back((unsigned char)(count | 0x80));
+		count >>= 7;
+	}
+	out.push_back((unsigned char)count);
+}
+
+static size_t getCount(const unsigned char *& in) {
+	size_t count = 0;
+	for (int shift = 0; ; shift += 7) {
+		unsigned char b = *in++;
+		count |= (size_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return count;
+	}
+}
+
+// XOR of a and b as (zero run, literal length, literal bytes) triples. A literal runs on
+// through single zero bytes, which are cheaper to copy than to start a new pair for.
+static void encodeDelta(const unsigned char * a, const unsigned char * b, size_t size, std::vector<unsigned char> & out) {
+	out.clear();
+	size_t i = 0;
+	while (i < size) {
+		size_t zeros = 0;
+		while (i + zeros < size && a[i + zeros] == b[i + zeros])
+			++zeros;
+		i += zeros;
+		if (i == size)
+			break;
+
+		size_t length = 0;
+		while (i + length < size && (a[i + length] != b[i + length]
+			|| (i + length + 1 < size && a[i + length + 1] != b[i + length + 1])))
+			++length;
+
+		putCount(out, zeros);
+		putCount(out, length);
+		for (size_t j = 0; j < length; ++j)
+			out.push_back(a[i + j] ^ b[i + j]);
+		i += length;
+	}
+}
+
+static void applyDelta(unsigned char * state, const std::vector<unsigned char> & delta) {
+	const unsigned char * in = delta.data();
+	const unsigned char * end = in + delta.size();
+	while (in < end) {
+		state += getCount(in);
+		size_t length = getCount(in);
+		for (size_t j = 0; j < length; ++j)
+			*state++ ^= *in++;
+	}
+}
+
+Chip8Rewind::Chip8Rewind(unsigned int capacity) : capacity(capacity), hasLatest(false), deltaBytes(0) {
+
+}
+
+void Chip8Rewind::clear() {
+	hasLatest = false;
+	deltas.clear();
+	deltaBytes = 0;
+}
+
+void Chip8Rewind::push(const Chip8& c8) {
+	Chip8State state;
+	c8.saveState(state);
+
+	if (hasLatest) {
+		// Drop the oldest frame once full, reusing its buffer for the new delta
+		std::vector<unsigned char> delta;
+		if (deltas.size() >= capacity && !deltas.empty()) {
+			deltaBytes -= deltas.front().size();
+			delta.swap(deltas.front());
+			deltas.pop_front();
+		}
+		encodeDelta((const unsigned char*)&state, (const unsigned char*)&latest, sizeof(Chip8State), delta);
+		deltaBytes += delta.size();
+		deltas.push_back(std::vector<unsigned char>());
+		deltas.back().swap(delta);
+	}
+
+	latest = state;
+	hasLatest = true;
+}
+
+bool Chip8Rewind::rewind(Chip8& c8) {
+	if (deltas.empty())
+		return false;
+
+	applyDelta((unsigned char*)&latest, deltas.back());
+	deltaBytes -= deltas.back().size();
+	deltas.pop_back();
+
+	c8.loadState(latest);
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "Chip8.h"
+
+// Everything needed to resume an instance exactly, in a fixed binary layout that is also
+// the save-state file format. Keys are input, not state, and are left alone on restore.
+struct Chip8State {
+	char     magic[4];			// "C8SS"
+	uint16_t version;
+	uint16_t pc;
+	uint16_t I;
+	uint16_t sp;
+	uint16_t stack[16];
+	uint8_t  V[16];
+	uint8_t  delay_timer;
+	uint8_t  sound_timer;
+	uint8_t  reserved[2];
+	uint64_t rngState;
+	uint64_t seed;
+	uint64_t frames;
+	uint64_t screen[32];
+	uint8_t  memory[4096];
+
+	bool save(const char * filename) const;
+	bool load(const char * filename);
+};
+
+// Rewind history holding a snapshot for each of the last capacity frames. Only the newest
+// snapshot is kept whole; each older one is stored as the XOR against the one after it,
+// run-length encoded, so a frame that changed a few registers and rows costs a few dozen
+// bytes. Stepping back one frame decodes a single delta, O(state size).
+class Chip8Rewind {
+
+public:
+	explicit Chip8Rewind(unsigned int capacity = 60 * 60);
+
+	void push(const Chip8& c8);		// Call after every frame
+	bool rewind(Chip8& c8);			// Steps c8 back one frame, false once the history runs out
+	void clear();
+
+	unsigned int frames() const { return (unsigned int)deltas.size(); }
+	size_t bytes() const { return deltaBytes; }
+
+private:
+	unsigned int capacity;
+	bool hasLatest;
+	Chip8State latest;
+	std::deque<std::vector<unsigned char> > deltas;	// Newest at the back
+	size_t deltaBytes;
+};
@@ -0,0 +1,53 @@
+#include "Chip8Trace.h"
+
+Chip8Tracer::Chip8Tracer() : cycles(0), dropped(0), running(false), file(NULL) {
+
+}
+
+Chip8Tracer::~Chip8Tracer() {
+	stop();
+}
+
+bool Chip8Tracer::start(const char * filename) {
+	stop();
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		return false;
+
+	Chip8TraceHeader header = { { 'C', '8', 'T', 'R' }, 2, sizeof(Chip8TraceRecord) };
+	fwrite(&header, sizeof(header), 1, file);
+
+	cycles = 0;
+	dropped = 0;
+	running = true;
+	writer = std::thread(&Chip8Tracer::drain, this);
+	return true;
+}
+
+// Writes out everything still queued before closing the file
+unsigned long long Chip8Tracer::stop() {
+	if (!running)
+		return droppedRecords();
+
+	running = false;
+	writer.join();
+	fclose(file);
+	file = NULL;
+	return droppedRecords();
+}
+
+void Chip8Tracer::drain() {
+	Chip8TraceRecord batch[1024];
+
+	for (;;) {
+		bool stopping = !running.load(std::memory_order_acquire);
+		size_t count = ring.pop(batch, 1024);
+		if (count > 0)
+			fwrite(batch, sizeof(Chip8TraceRecord), count, file);
+		else if (stopping)
+			break;
+		else
+			std::this_thread::yield(); // Spin rather than sleep, so the ring doesn't fill up and drop records
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "Chip8Queue.h"
+
+// Machine state just before an instruction executes
+struct Chip8TraceRecord {
+	uint64_t cycle;			// Instructions traced before this one. A jump marks dropped records.
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t I;
+	uint8_t  sp;
+	uint8_t  delay_timer;
+	uint8_t  V[16];
+};
+
+// Header at the start of a trace file, followed by packed Chip8TraceRecords
+struct Chip8TraceHeader {
+	char     magic[4];		// "C8TR"
+	uint16_t version;
+	uint16_t recordSize;
+};
+
+// Per-instance instruction trace. The emulator thread writes fixed-size records into a
+// lock-free ring; a background thread drains them to a file. Records are dropped rather
+// than blocking the emulator when the writer falls behind, leaving a gap in the cycle numbers.
+class Chip8Tracer {
+
+public:
+	Chip8Tracer();
+	~Chip8Tracer();
+
+	bool start(const char * filename);
+	// Returns how many records were dropped
+	unsigned long long stop();
+
+	void record(Chip8TraceRecord& r) {
+		r.cycle = cycles++;
+		if (!ring.push(r))
+			dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	unsigned long long droppedRecords() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	Chip8SpscQueue<Chip8TraceRecord, 1 << 16> ring;
+	uint64_t cycles;
+	std::atomic<unsigned long long> dropped;
+	std::atomic<bool> running;
+	std::thread writer;
+	FILE * file;
+
+	void drain();
+};
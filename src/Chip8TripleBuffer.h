@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free hand-off of the latest value from one writer thread to one reader thread. The
+// writer fills the back slot and publishes it; the reader picks up the newest published slot.
+// Neither side ever waits for the other, and the reader never sees a half-written value.
+template <typename T>
+class Chip8TripleBuffer {
+
+public:
+	Chip8TripleBuffer() : middle(1), back(2), front(0) {}
+
+	// Writer side: fill the back slot, then publish it
+	T & writeSlot() { return slots[back]; }
+	void publish() {
+		back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index;
+	}
+
+	// Reader side: swaps in the newest published slot, false when nothing new was published
+	bool update() {
+		if ((middle.load(std::memory_order_relaxed) & fresh) == 0)
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & index;
+		return true;
+	}
+	const T & readSlot() const { return slots[front]; }
+
+private:
+	static const unsigned int index = 3;
+	static const unsigned int fresh = 4;	// Set in middle when it holds a slot the reader hasn't taken
+
+	// The slot in between the two sides, and the one each side owns, on separate cache lines
+	alignas(64) std::atomic<unsigned int> middle;
+	alignas(64) unsigned int back;
+	alignas(64) unsigned int front;
+	T slots[3];
+};
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Chip8Batch.h"
+
+// Batch runner: runs many independent instances of one or more ROMs across every core
+// and reports aggregate throughput plus a result line per instance.
+
+void usage() {
+	printf("Usage: chip8batch [options] chip8application...\n\n");
+	printf("  -n N    Instances per application (default 1)\n");
+	printf("  -f N    Frames per instance (default 600)\n");
+	printf("  -h      Stop an instance early once its program halts\n");
+	printf("  -j N    Worker threads (default: one per hardware thread)\n");
+	printf("  -i N    Instructions per frame (default 10)\n");
+	printf("  -e E    Engine: interpreter, cached or jit (default interpreter)\n");
+	printf("  -Q Q    Quirk profile: default, vip, chip48 or schip (default default)\n");
+	printf("  -s N    Seed of the first instance (default 1), the others count up from it\n");
+	printf("  -o F    Write per-instance results to F as CSV\n");
+	printf("  -q      Only print the totals\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int instances = 1;
+	unsigned int threads = 0;
+	bool quiet = false;
+	const char * csvFile = NULL;
+	std::vector<const char *> filenames;
+
+	Chip8BatchJob job;
+	job.frames = 600;
+	job.stopWhenHalted = false;
+	job.seed = 1;
+	job.engine = Chip8Engine::Interpreter;
+	job.quirks = Chip8Quirks::Default;
+	job.cyclesPerFrame = 10;
+	job.skipIdle = true;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			instances = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			job.frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-h") == 0)
+			job.stopWhenHalted = true;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			job.cyclesPerFrame = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "interpreter") == 0)
+				job.engine = Chip8Engine::Interpreter;
+			else if (strcmp(argv[i], "cached") == 0)
+				job.engine = Chip8Engine::Cached;
+			else if (strcmp(argv[i], "jit") == 0)
+				job.engine = Chip8Engine::Jit;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "default") == 0)
+				job.quirks = Chip8Quirks::Default;
+			else if (strcmp(argv[i], "vip") == 0)
+				job.quirks = Chip8Quirks::Vip;
+			else if (strcmp(argv[i], "chip48") == 0)
+				job.quirks = Chip8Quirks::Chip48;
+			else if (strcmp(argv[i], "schip") == 0)
+				job.quirks = Chip8Quirks::SuperChip;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			job.seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			csvFile = argv[++i];
+		else if (strcmp(argv[i], "-q") == 0)
+			quiet = true;
+		else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		}
+		else
+			filenames.push_back(argv[i]);
+	}
+
+	if (filenames.empty() || instances == 0) {
+		usage();
+		return 1;
+	}
+
+	Chip8Batch batch(threads);
+	uint64_t seed = job.seed;
+	for (const char * filename : filenames) {
+		job.rom = filename;
+		for (unsigned int i = 0; i < instances; ++i) {
+			job.seed = seed++;
+			batch.add(job);
+		}
+	}
+
+	batch.run();
+
+	const std::vector<Chip8BatchJob> & jobs = batch.jobs();
+	const std::vector<Chip8BatchResult> & results = batch.results();
+
+	FILE * csv = NULL;
+	if (csvFile != NULL) {
+		csv = fopen(csvFile, "w");
+		if (csv == NULL) {
+			printf("Could not open %s\n", csvFile);
+			return 1;
+		}
+		fprintf(csv, "instance,rom,seed,loaded,halted,frames,cycles,idle_cycles,unknown_opcodes,seconds,frame_hash\n");
+	}
+
+	size_t failed = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Chip8BatchResult & r = results[i];
+		if (!r.loaded)
+			++failed;
+		if (!quiet) {
+			if (r.loaded)
+				printf("%6zu  %-24s seed %-6llu frames %-8llu %s hash %016llx\n", i, jobs[i].rom.c_str(),
+					(unsigned long long)jobs[i].seed, r.frames, r.halted ? "halted " : "       ", r.frameHash);
+			else
+				printf("%6zu  %-24s could not be loaded\n", i, jobs[i].rom.c_str());
+		}
+		if (csv != NULL)
+			fprintf(csv, "%zu,%s,%llu,%d,%d,%llu,%llu,%llu,%llu,%.6f,%016llx\n", i, jobs[i].rom.c_str(),
+				(unsigned long long)jobs[i].seed, r.loaded, r.halted, r.frames, r.cycles, r.idleCycles,
+				r.unknownOpcodes, r.seconds, r.frameHash);
+	}
+	if (csv != NULL)
+		fclose(csv);
+
+	printf("instances: %zu\n", results.size());
+	printf("failed to load: %zu\n", failed);
+	printf("threads: %u\n", batch.threadCount());
+	printf("frames: %llu\n", batch.totalFrames);
+	printf("cycles: %llu\n", batch.totalCycles);
+	printf("seconds: %.6f\n", batch.seconds);
+	printf("instructions/second: %.0f\n", batch.seconds > 0 ? batch.totalCycles / batch.seconds : 0.0);
+	printf("frames/second: %.0f\n", batch.seconds > 0 ? batch.totalFrames / batch.seconds : 0.0);
+	printf("memory pages copied from shared images: %llu (%.2f KB per instance)\n", batch.totalCopiedPages,
+		results.empty() ? 0.0 : batch.totalCopiedPages * 64 / 1024.0 / results.size());
+
+	return failed == 0 ? 0 : 1;
+}
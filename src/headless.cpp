@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include "Chip8.h"
+#include "Chip8Audio.h"
+#include "Chip8Capture.h"
+#include "Chip8Extended.h"
+#include "Chip8Input.h"
+#include "Chip8State.h"
+#if CHIP8_PROFILE
+#include "Chip8Profile.h"
+#endif
+
+// Headless runner: executes a ROM as fast as possible without a window
+// and reports throughput plus a hash of the final framebuffer.
+
+Chip8 interpreter;
+
+void usage() {
+	printf("Usage: chip8run [options] chip8application\n\n");
+	printf("  -c N    Execute N cycles (default 1000000)\n");
+	printf("  -f N    Execute N frames instead of a cycle count\n");
+	printf("  -i N    Instructions per frame (default 10)\n");
+	printf("  -e E    Engine: interpreter, cached or jit (default interpreter)\n");
+	printf("  -Q Q    Quirk profile: default, vip, chip48 or schip (default default)\n");
+	printf("  -m M    Machine: chip8, schip or xochip (default chip8). The extended machines\n");
+	printf("          only take -c, -f, -i, -s, -a and -d\n");
+	printf("  -s N    Random seed (default 1), so runs are repeatable\n");
+	printf("  -n      Don't fast-forward idle loops\n");
+	printf("  -r F    Record the session's seed, input and final frame to F\n");
+	printf("  -p F    Replay the session recorded in F and check it ends on the same frame\n");
+	printf("  -l F    Start from the save-state in F. Input logs start from power-on, so this\n");
+	printf("          can't be combined with -r or -p\n");
+	printf("  -w F    Write a save-state to F at the end\n");
+	printf("  -a F    Write the sound timer's tone to WAV file F\n");
+	printf("  -v F    Capture every frame to F, Y4M video if it ends in .y4m, raw greyscale otherwise\n");
+	printf("  -x N    Scale captured frames up N times (default 1)\n");
+#if CHIP8_TRACE
+	printf("  -t F    Write an instruction trace to file F\n");
+#endif
+#if CHIP8_PROFILE
+	printf("  -P F    Profile the run, writing folded stacks to F.folded and a summary to F.json\n");
+#endif
+	printf("  -d      Render the final framebuffer to the console\n\n");
+}
+
+// SUPER-CHIP and XO-CHIP runs, on the separate Chip8Extended machine
+int runExtended(Chip8ExtendedMode mode, const char * filename, unsigned long long cycles, unsigned long long frames,
+	unsigned int cyclesPerFrame, unsigned int seed, const char * audioFile, bool render) {
+	static Chip8Extended machine(mode);
+	machine.cyclesPerFrame = cyclesPerFrame;
+	if (!machine.loadApplication(filename))
+		return 1;
+	machine.seedRandom(seed);
+
+	unsigned long long remainder = 0;
+	if (frames > 0)
+		cycles = frames * cyclesPerFrame;
+	else if (cyclesPerFrame > 0) {
+		frames = cycles / cyclesPerFrame;
+		remainder = cycles % cyclesPerFrame;
+	}
+
+	Chip8Audio audio;
+	Chip8WavSink wav(audioFile != NULL ? audioFile : "");
+	if (audioFile != NULL && !audio.start(&wav)) {
+		printf("Could not write audio file %s\n", audioFile);
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < frames && !machine.halted(); ++i) {
+		machine.runFrame();
+		if (audioFile != NULL)
+			audio.frame(machine);
+	}
+	machine.runCycles(remainder);
+	auto end = std::chrono::steady_clock::now();
+	if (!audio.stop()) {
+		printf("Could not write audio file %s\n", audioFile);
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	if (render)
+		machine.debugRender();
+
+	printf("cycles: %llu\n", cycles);
+	printf("frames: %llu\n", machine.frames);
+	printf("resolution: %dx%d%s\n", machine.width(), machine.height(), machine.halted() ? ", exited" : "");
+	printf("unknown opcodes: %llu\n", machine.unknownOpcodes);
+	printf("seconds: %.6f\n", seconds);
+	printf("instructions/second: %.0f\n", seconds > 0 ? cycles / seconds : 0.0);
+	printf("framebuffer hash: %016llx\n", machine.frameHash());
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long cycles = 1000000;
+	unsigned long long frames = 0;
+	unsigned int cyclesPerFrame = 10;
+	unsigned int seed = 1;
+	bool render = false;
+	bool skipIdle = true;
+#if CHIP8_TRACE
+	const char * traceFile = NULL;
+#endif
+#if CHIP8_PROFILE
+	const char * profileName = NULL;
+#endif
+	const char * recordFile = NULL;
+	const char * replayFile = NULL;
+	const char * loadStateFile = NULL;
+	const char * saveStateFile = NULL;
+	const char * audioFile = NULL;
+	const char * captureFile = NULL;
+	int captureScale = 1;
+	Chip8Engine engine = Chip8Engine::Interpreter;
+	Chip8Quirks quirks = Chip8Quirks::Default;
+	bool extended = false;
+	Chip8ExtendedMode extendedMode = Chip8ExtendedMode::SuperChip;
+	bool classicOption = false;		// An option the extended machines don't take was given
+	const char * filename = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i][0] == '-' && argv[i][1] != 0 && argv[i][2] == 0 && strchr("eQnrplwvxtP", argv[i][1]) != NULL)
+			classicOption = true;
+
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			cyclesPerFrame = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "interpreter") == 0)
+				engine = Chip8Engine::Interpreter;
+			else if (strcmp(argv[i], "cached") == 0)
+				engine = Chip8Engine::Cached;
+			else if (strcmp(argv[i], "jit") == 0)
+				engine = Chip8Engine::Jit;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "default") == 0)
+				quirks = Chip8Quirks::Default;
+			else if (strcmp(argv[i], "vip") == 0)
+				quirks = Chip8Quirks::Vip;
+			else if (strcmp(argv[i], "chip48") == 0)
+				quirks = Chip8Quirks::Chip48;
+			else if (strcmp(argv[i], "schip") == 0)
+				quirks = Chip8Quirks::SuperChip;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			++i;
+			extended = strcmp(argv[i], "chip8") != 0;
+			if (strcmp(argv[i], "schip") == 0)
+				extendedMode = Chip8ExtendedMode::SuperChip;
+			else if (strcmp(argv[i], "xochip") == 0)
+				extendedMode = Chip8ExtendedMode::XoChip;
+			else if (extended) {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0)
+			skipIdle = false;
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			recordFile = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			replayFile = argv[++i];
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			loadStateFile = argv[++i];
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			saveStateFile = argv[++i];
+		else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+			audioFile = argv[++i];
+		else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+			captureFile = argv[++i];
+		else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+			captureScale = atoi(argv[++i]);
+#if CHIP8_TRACE
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			traceFile = argv[++i];
+#endif
+#if CHIP8_PROFILE
+		else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+			profileName = argv[++i];
+#endif
+		else if (strcmp(argv[i], "-d") == 0)
+			render = true;
+		else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		}
+		else
+			filename = argv[i];
+	}
+
+	bool logFromState = loadStateFile != NULL && (recordFile != NULL || replayFile != NULL);
+	if (filename == NULL || (extended && classicOption) || logFromState) {
+		usage();
+		return 1;
+	}
+
+	if (extended)
+		return runExtended(extendedMode, filename, cycles, frames, cyclesPerFrame, seed, audioFile, render);
+
+	// Load game
+	interpreter.setEngine(engine);
+	interpreter.setQuirks(quirks);
+	interpreter.cyclesPerFrame = cyclesPerFrame;
+	interpreter.skipIdle = skipIdle;
+	if (!interpreter.loadApplication(filename))
+		return 1;
+	interpreter.seedRandom(seed);
+
+	if (loadStateFile != NULL) {
+		Chip8State state;
+		if (!state.load(loadStateFile)) {
+			printf("Could not read save-state %s\n", loadStateFile);
+			return 1;
+		}
+		interpreter.loadState(state);
+	}
+
+#if CHIP8_TRACE
+	if (traceFile != NULL && !interpreter.startTrace(traceFile)) {
+		printf("Could not open trace file %s\n", traceFile);
+		return 1;
+	}
+#endif
+
+#if CHIP8_PROFILE
+	if (profileName != NULL)
+		interpreter.startProfile();
+#endif
+
+	// A cycle count runs as whole frames plus whatever is left over
+	unsigned long long remainder = 0;
+	if (frames > 0)
+		cycles = frames * cyclesPerFrame;
+	else if (cyclesPerFrame > 0) {
+		frames = cycles / cyclesPerFrame;
+		remainder = cycles % cyclesPerFrame;
+	}
+
+	// Input logs only cover whole frames
+	Chip8InputLog inputLog;
+	if (replayFile != NULL) {
+		if (!inputLog.load(replayFile)) {
+			printf("Could not read input log %s\n", replayFile);
+			return 1;
+		}
+		if (inputLog.info().memoryHash != interpreter.memoryHash()) {
+			printf("Input log %s was recorded with a different application\n", replayFile);
+			return 1;
+		}
+		frames = inputLog.info().frames;
+		cycles = frames * inputLog.info().cyclesPerFrame;
+		remainder = 0;
+	}
+	else if (recordFile != NULL) {
+		if (!inputLog.start(interpreter)) {
+			printf("Input log %s can only record from power-on\n", recordFile);
+			return 1;
+		}
+		cycles -= remainder;
+		remainder = 0;
+	}
+
+	// Audio follows emulated frames, so the file matches the run however fast it went
+	Chip8Audio audio;
+	Chip8WavSink wav(audioFile != NULL ? audioFile : "");
+	if (audioFile != NULL && !audio.start(&wav)) {
+		printf("Could not write audio file %s\n", audioFile);
+		return 1;
+	}
+
+	// Frames are converted and written on a background thread
+	Chip8Capture capture;
+	if (captureFile != NULL) {
+		size_t length = strlen(captureFile);
+		bool y4m = length > 4 && strcmp(captureFile + length - 4, ".y4m") == 0;
+		if (!capture.start(captureFile, y4m ? Chip8CaptureFormat::Y4M : Chip8CaptureFormat::Raw, captureScale)) {
+			printf("Could not write video file %s\n", captureFile);
+			return 1;
+		}
+	}
+	bool perFrame = audioFile != NULL || captureFile != NULL;
+
+	bool replayed = true;
+	auto start = std::chrono::steady_clock::now();
+	if (replayFile != NULL && !perFrame)
+		replayed = inputLog.replay(interpreter);
+	else if (replayFile != NULL) {
+		replayed = inputLog.begin(interpreter);
+		while (replayed && interpreter.frames < inputLog.info().frames) {
+			inputLog.apply(interpreter);
+			interpreter.runFrame();
+			audio.frame(interpreter);
+			capture.frame(interpreter);
+		}
+		replayed = replayed && interpreter.frameHash() == inputLog.info().frameHash;
+	}
+	else {
+		for (unsigned long long i = 0; i < frames; ++i) {
+			if (recordFile != NULL)
+				inputLog.record(interpreter);
+			interpreter.runFrame();
+			if (perFrame) {
+				audio.frame(interpreter);
+				capture.frame(interpreter);
+			}
+		}
+		interpreter.runCycles(remainder);
+	}
+	auto end = std::chrono::steady_clock::now();
+	if (!audio.stop()) {
+		printf("Could not write audio file %s\n", audioFile);
+		return 1;
+	}
+	if (!capture.stop()) {
+		printf("Could not write video file %s\n", captureFile);
+		return 1;
+	}
+
+	if (recordFile != NULL) {
+		inputLog.finish(interpreter);
+		if (!inputLog.save(recordFile)) {
+			printf("Could not write input log %s\n", recordFile);
+			return 1;
+		}
+	}
+
+	if (saveStateFile != NULL) {
+		Chip8State state;
+		interpreter.saveState(state);
+		if (!state.save(saveStateFile)) {
+			printf("Could not write save-state %s\n", saveStateFile);
+			return 1;
+		}
+	}
+
+#if CHIP8_TRACE
+	unsigned long long droppedRecords = interpreter.stopTrace();
+	if (droppedRecords > 0)
+		printf("Trace dropped %llu records\n", droppedRecords);
+#endif
+
+#if CHIP8_PROFILE
+	if (profileName != NULL) {
+		std::string folded = std::string(profileName) + ".folded";
+		std::string json = std::string(profileName) + ".json";
+		if (!interpreter.profile()->writeFolded(folded.c_str()) || !interpreter.profile()->writeJson(json.c_str())) {
+			printf("Could not write profile %s\n", profileName);
+			return 1;
+		}
+	}
+#endif
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	if (render)
+		interpreter.debugRender();
+
+	printf("cycles: %llu\n", cycles);
+	printf("frames: %llu\n", frames);
+	printf("idle cycles skipped: %llu\n", interpreter.idleCycles);
+	printf("unknown opcodes: %llu\n", interpreter.unknownOpcodes);
+	printf("seconds: %.6f\n", seconds);
+	printf("instructions/second: %.0f\n", seconds > 0 ? cycles / seconds : 0.0);
+	printf("framebuffer hash: %016llx\n", interpreter.frameHash());
+	if (captureFile != NULL)
+		printf("frames captured: %llu (%llu repeats, %llu writer stalls)\n", capture.frames, capture.repeats, capture.stalls);
+	if (replayFile != NULL)
+		printf("replay: %s\n", replayed ? "matches the recording" : "DIFFERS FROM THE RECORDING");
+
+	return replayed ? 0 : 1;
+}
@@ -1,43 +1,115 @@
 #include <stdio.h>
-#include <GL\glut.h>
+#include <string.h>
+#include <GL/glut.h>
 #include "Chip8.h"
+#include "Chip8Audio.h"
+#include "Chip8Extended.h"
+#include "Chip8Input.h"
+#include "Chip8State.h"
+#include "Chip8TripleBuffer.h"
 #include <iostream>
+#ifdef _WIN32
 #include <windows.h> // WinApi header 
+#endif
 #include <thread>         // std::thread
+#include <chrono>
+#include <atomic>
 
 // Display size
 #define SCREEN_WIDTH 64
 #define SCREEN_HEIGHT 32
 
+// Texture size, big enough for SUPER-CHIP's high resolution
+#define TEXTURE_WIDTH 128
+#define TEXTURE_HEIGHT 64
+
 Chip8 interpreter;
+
+// SUPER-CHIP (.sc8) and XO-CHIP (.xo8) applications run on this instead
+Chip8Extended extended;
+bool extendedMode = false;
 int modifier = 10;
 
+// Optional recording of the session's input, written out on exit
+Chip8InputLog inputLog;
+const char * inputLogFile = NULL;
+
+// Keys pressed in GLUT callbacks, applied by the emulation at the matching instruction
+Chip8InputQueue inputQueue;
+
+// Sound timer tone, pulled by the audio device's own thread
+Chip8Audio audio;
+Chip8SystemSink audioDevice;
+
+// Last minute of frames, played back in reverse while backspace is held
+Chip8Rewind rewindHistory(60 * 60);
+std::atomic<bool> rewinding(false);
+
+// Emulated frames run at 60 Hz against absolute deadlines on their own thread, sleeping in between
+const std::chrono::nanoseconds frameDuration(1000000000 / 60);
+const int maxCatchUpFrames = 4;
+std::thread emulationThread;
+std::atomic<bool> running(true);
+
+// Completed frames handed from the emulation thread to the GLUT thread
+struct Chip8Frame {
+	int width;
+	int height;
+	uint64_t rows[2][TEXTURE_HEIGHT][TEXTURE_WIDTH / 64];	// Both bit planes, width / 64 words a row
+};
+Chip8TripleBuffer<Chip8Frame> frames;
+Chip8Frame shown;	// Framebuffer currently in the texture
+
+// Grey levels for the two bit planes, classic applications only use the first two
+const unsigned char palette[4] = { 0, 255, 170, 85 };
+
 // Window size
 int display_width = SCREEN_WIDTH * modifier;
 int display_height = SCREEN_HEIGHT * modifier;
 
 void display();
+void checkFrame(int value);
+void emulate();
+void emulateExtended();
 void reshape_window(GLsizei w, GLsizei h);
 void keyboardUp(unsigned char key, int x, int y);
 void keyboardDown(unsigned char key, int x, int y);
 
-typedef unsigned __int8 u8;
-u8 screenData[SCREEN_HEIGHT][SCREEN_WIDTH][3];
+typedef unsigned char u8;
+u8 screenData[TEXTURE_HEIGHT][TEXTURE_WIDTH];	// Single channel, one byte per pixel
 void setupTexture();
 
-void playAudio();
-
 int main(int argc, char **argv)
 {
 	if (argc < 2) {
-		printf("Usage: Chip8.exe chip8application\n\n");
+		printf("Usage: Chip8.exe chip8application [instructions per frame] [input log to record]\n\n");
 		return 1;
 	}
 
+	size_t length = strlen(argv[1]);
+	const char * extension = length > 4 ? argv[1] + length - 4 : "";
+	if (strcmp(extension, ".sc8") == 0 || strcmp(extension, ".xo8") == 0) {
+		extendedMode = true;
+		extended.mode = strcmp(extension, ".xo8") == 0 ? Chip8ExtendedMode::XoChip : Chip8ExtendedMode::SuperChip;
+	}
+
+	if (argc > 2) {
+		interpreter.cyclesPerFrame = atoi(argv[2]);
+		extended.cyclesPerFrame = atoi(argv[2]);
+	}
+
 	// Load game
-	if (!interpreter.loadApplication(argv[1]))
+	if (extendedMode ? !extended.loadApplication(argv[1]) : !interpreter.loadApplication(argv[1]))
 		return 1;
 
+	// Input logs and save-states only cover the classic machine
+	if (argc > 3 && extendedMode)
+		printf("Input logs can't be recorded for SUPER-CHIP or XO-CHIP applications\n");
+	else if (argc > 3) {
+		inputLogFile = argv[3];
+		inputLog.start(interpreter);
+	}
+
 	// Setup OpenGL
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
@@ -47,13 +119,21 @@ int main(int argc, char **argv)
 	glutCreateWindow("Chip8 Interpreter");
 
 	glutDisplayFunc(display);
-	glutIdleFunc(display);
+	glutTimerFunc(0, checkFrame, 0);
 	glutReshapeFunc(reshape_window);
 	glutKeyboardFunc(keyboardDown);
 	glutKeyboardUpFunc(keyboardUp);
 
 	setupTexture();
 
+#ifdef _WIN32
+	timeBeginPeriod(1); // Millisecond sleep granularity for frame pacing
+#endif
+
+	if (!audio.start(&audioDevice))
+		printf("No audio device, running without sound\n");
+
+	emulationThread = std::thread(extendedMode ? emulateExtended : emulate);
 	glutMainLoop();
 
 	return 0;
@@ -62,12 +142,14 @@ int main(int argc, char **argv)
 // Setup texture
 void setupTexture() {
 	// Clear screen
-	for (int y = 0; y < SCREEN_HEIGHT; ++y)
-		for (int x = 0; x < SCREEN_WIDTH; ++x)
-			screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 0;
+	memset(screenData, 0, sizeof(screenData));
+	memset(&shown, 0, sizeof(shown));
+	shown.width = SCREEN_WIDTH;
+	shown.height = SCREEN_HEIGHT;
 
-	// Create a texture
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
+	// Create a texture, frames at low resolution only use its top left quarter
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
 
 	// Setup the texture
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -79,60 +161,157 @@ void setupTexture() {
 	glEnable(GL_TEXTURE_2D);
 }
 
-void updateTexture(const Chip8& c8) {
-	// Update pixels
-	for (int y = 0; y < 32; ++y) {
-		for (int x = 0; x < 64; ++x) {
-			if (c8.pixels[(y * 64) + x] == 0)
-				screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 0; // Disable
-			else
-				screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 255; // Enable
+void updateTexture(const Chip8Frame& frame) {
+	// Frames published in between may never be shown, so compare against what the texture holds.
+	// Everything is redrawn when the resolution changes. Nothing has been published yet while the width is 0.
+	const int words = frame.width / 64;
+	uint64_t dirty = 0;
+	for (int y = 0; y < frame.height; ++y) {
+		for (int i = 0; i < words; ++i) {
+			if (frame.rows[0][y][i] != shown.rows[0][y][i] || frame.rows[1][y][i] != shown.rows[1][y][i])
+				dirty |= 1ULL << y;
 		}
 	}
+	if (frame.width != shown.width && frame.width != 0) {
+		dirty = frame.height == 64 ? ~0ULL : (1ULL << frame.height) - 1;
+		shown.width = frame.width;
+		shown.height = frame.height;
+	}
 
-	// Update texture
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
+	// Convert and upload only the rows that differ, one call per run of dirty rows
 
+	int y = 0;
+	while (dirty != 0) {
+		if ((dirty & 1) == 0) {
+			dirty >>= 1;
+			++y;
+			continue;
+		}
+
+		int first = y;
+		for (; dirty & 1; dirty >>= 1, ++y) {
+			for (int x = 0; x < frame.width; ++x) {
+				int bit = 63 - x % 64;
+				int colour = (frame.rows[0][y][x / 64] >> bit & 1) | (frame.rows[1][y][x / 64] >> bit & 1) << 1;
+				screenData[y][x] = palette[colour];
+			}
+			memcpy(shown.rows[0][y], frame.rows[0][y], words * sizeof(uint64_t));
+			memcpy(shown.rows[1][y], frame.rows[1][y], words * sizeof(uint64_t));
+		}
+
+		// Rows are TEXTURE_WIDTH pixels apart in screenData
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, TEXTURE_WIDTH);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, frame.width, y - first, GL_LUMINANCE, GL_UNSIGNED_BYTE, (GLvoid*)screenData[first]);
+	}
+
+	double right = (double)shown.width / TEXTURE_WIDTH;
+	double bottom = (double)shown.height / TEXTURE_HEIGHT;
 	glBegin(GL_QUADS);
 		glTexCoord2d(0.0, 0.0);
 		glVertex2d(0.0, 0.0);
 
-		glTexCoord2d(1.0, 0.0);
+		glTexCoord2d(right, 0.0);
 		glVertex2d(display_width, 0.0);
 
-		glTexCoord2d(1.0, 1.0);
+		glTexCoord2d(right, bottom);
 		glVertex2d(display_width, display_height);
 
-		glTexCoord2d(0.0, 1.0);
+		glTexCoord2d(0.0, bottom);
 		glVertex2d(0.0, display_height);
 	glEnd();
 }
 
-void playAudio() {
-	Beep(400, 500); // 400 hertz (C5) for 500 milliseconds    
-}
-
 void display() {
-	interpreter.emulateCycle();
-	//interpreter.execute();
-	if (interpreter.drawFlag) {
-		// Clear framebuffer
-		glClear(GL_COLOR_BUFFER_BIT);
+	// Clear framebuffer
+	glClear(GL_COLOR_BUFFER_BIT);
 
-		// Update texture
-		updateTexture(interpreter);
+	// Update texture from the newest complete frame
+	updateTexture(frames.readSlot());
 
-		// Swap buffers
-		glutSwapBuffers();
+	// Swap buffers, blocking only this thread on vsync
+	glutSwapBuffers();
+}
+
+// Looks for a newly published frame once per 60 Hz frame, so the render thread sleeps in GLUT
+// in between instead of waking every millisecond. 16 ms runs slightly ahead of the emulation.
+void checkFrame(int value) {
+	if (frames.update())
+		glutPostRedisplay();
+	glutTimerFunc(1000 / 60, checkFrame, value);
+}
 
-		// Finished processing frame
-		interpreter.drawFlag = false;
+// SUPER-CHIP and XO-CHIP frames, without rewinding or input logs
+void emulateExtended() {
+	auto nextFrame = std::chrono::steady_clock::now();
+	while (running.load(std::memory_order_relaxed)) {
+		std::this_thread::sleep_until(nextFrame);
+
+		auto now = std::chrono::steady_clock::now();
+		for (int i = 0; i < maxCatchUpFrames && now >= nextFrame; ++i) {
+			uint64_t frameStart = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>((nextFrame - frameDuration).time_since_epoch()).count();
+			inputQueue.runFrame(extended, frameStart, frameDuration.count());
+			audio.frame(extended);
+			nextFrame += frameDuration;
+		}
+		if (now >= nextFrame)
+			nextFrame = now + frameDuration;
+
+		if (extended.presentFrame()) {
+			Chip8Frame & frame = frames.writeSlot();
+			frame.width = extended.width();
+			frame.height = extended.height();
+			for (int p = 0; p < 2; ++p) {
+				for (int y = 0; y < frame.height; ++y)
+					memcpy(frame.rows[p][y], extended.row(p, y), frame.width / 64 * sizeof(uint64_t));
+			}
+			frames.publish();
+		}
 	}
+}
 
-	if (interpreter.playBeep) {
-		interpreter.playBeep = false;
-		std::thread t1(playAudio);
-		t1.detach();
+void emulate() {
+	auto nextFrame = std::chrono::steady_clock::now();
+	while (running.load(std::memory_order_relaxed)) {
+		std::this_thread::sleep_until(nextFrame);
+
+		// Run every frame that is due, dropping the backlog after a long stall
+		auto now = std::chrono::steady_clock::now();
+		for (int i = 0; i < maxCatchUpFrames && now >= nextFrame; ++i) {
+			// The frame due now covers the frame duration that just passed
+			uint64_t frameStart = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>((nextFrame - frameDuration).time_since_epoch()).count();
+
+			if (rewinding.load(std::memory_order_relaxed)) {
+				inputQueue.applyAll(interpreter);
+				rewindHistory.rewind(interpreter);
+			}
+			else if (inputLogFile != NULL) {
+				// Input logs hold the keys at the start of each frame
+				inputQueue.applyAll(interpreter);
+				inputLog.record(interpreter);
+				interpreter.runFrame();
+				rewindHistory.push(interpreter);
+			}
+			else {
+				inputQueue.runFrame(interpreter, frameStart, frameDuration.count());
+				rewindHistory.push(interpreter);
+			}
+			audio.frame(interpreter);
+			nextFrame += frameDuration;
+		}
+		if (now >= nextFrame)
+			nextFrame = now + frameDuration;
+
+		// Hand the finished frame to the render thread, never waiting on it, if it changed at all
+		if (interpreter.presentFrame()) {
+			Chip8Frame & frame = frames.writeSlot();
+			frame.width = SCREEN_WIDTH;
+			frame.height = SCREEN_HEIGHT;
+			for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+				frame.rows[0][y][0] = interpreter.screen[y];
+				frame.rows[1][y][0] = 0;
+			}
+			frames.publish();
+		}
 	}
 }
 
@@ -151,49 +330,37 @@ void reshape_window(GLsizei w, GLsizei h){
 
 void keyboardDown(unsigned char key, int x, int y)
 {
-	if (key == 27)    // esc
+	if (key == 27) {    // esc
+		running = false;
+		emulationThread.join();
+		audio.stop();
+
+		if (inputLogFile != NULL) {
+			inputLog.finish(interpreter);
+			if (!inputLog.save(inputLogFile))
+				printf("Could not write input log %s\n", inputLogFile);
+		}
+		if (extendedMode)
+			printf("Presented %llu frames, skipped %llu unchanged\n", extended.presents, extended.skippedPresents);
+		else
+			printf("Presented %llu frames, skipped %llu unchanged\n", interpreter.presents, interpreter.skippedPresents);
+		if (inputQueue.events > 0)
+			printf("Input latency: %.2f ms average, %.2f ms worst over %llu key events\n",
+				inputQueue.totalLatency / 1e6 / inputQueue.events, inputQueue.maxLatency / 1e6, inputQueue.events);
 		exit(0);
+	}
 
-	if (key == '1')		interpreter.key[0x1] = 1;
-	else if (key == '2')	interpreter.key[0x2] = 1;
-	else if (key == '3')	interpreter.key[0x3] = 1;
-	else if (key == '4')	interpreter.key[0xC] = 1;
-
-	else if (key == 'q')	interpreter.key[0x4] = 1;
-	else if (key == 'w')	interpreter.key[0x5] = 1;
-	else if (key == 'e')	interpreter.key[0x6] = 1;
-	else if (key == 'r')	interpreter.key[0xD] = 1;
-
-	else if (key == 'a')	interpreter.key[0x7] = 1;
-	else if (key == 's')	interpreter.key[0x8] = 1;
-	else if (key == 'd')	interpreter.key[0x9] = 1;
-	else if (key == 'f')	interpreter.key[0xE] = 1;
-
-	else if (key == 'z')	interpreter.key[0xA] = 1;
-	else if (key == 'x')	interpreter.key[0x0] = 1;
-	else if (key == 'c')	interpreter.key[0xB] = 1;
-	else if (key == 'v')	interpreter.key[0xF] = 1;
+	// A recording can't go back in time, so rewinding is off while one is made
+	if (key == 8 && inputLogFile == NULL && !extendedMode)	// backspace
+		rewinding = true;
+
+	inputQueue.push(key, true);
 }
 
 void keyboardUp(unsigned char key, int x, int y)
 {
-	if (key == '1')		interpreter.key[0x1] = 0;
-	else if (key == '2')	interpreter.key[0x2] = 0;
-	else if (key == '3')	interpreter.key[0x3] = 0;
-	else if (key == '4')	interpreter.key[0xC] = 0;
-
-	else if (key == 'q')	interpreter.key[0x4] = 0;
-	else if (key == 'w')	interpreter.key[0x5] = 0;
-	else if (key == 'e')	interpreter.key[0x6] = 0;
-	else if (key == 'r')	interpreter.key[0xD] = 0;
-
-	else if (key == 'a')	interpreter.key[0x7] = 0;
-	else if (key == 's')	interpreter.key[0x8] = 0;
-	else if (key == 'd')	interpreter.key[0x9] = 0;
-	else if (key == 'f')	interpreter.key[0xE] = 0;
-
-	else if (key == 'z')	interpreter.key[0xA] = 0;
-	else if (key == 'x')	interpreter.key[0x0] = 0;
-	else if (key == 'c')	interpreter.key[0xB] = 0;
-	else if (key == 'v')	interpreter.key[0xF] = 0;
+	if (key == 8)
+		rewinding = false;
+
+	inputQueue.push(key, false);
 }